@@ -0,0 +1,61 @@
+#include "bloom_filter.h"
+
+#include <algorithm>
+
+namespace {
+
+const uint32_t kSalts[] = {0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+                           0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u};
+
+}  // namespace
+
+BloomFilter::BloomFilter(int64_t expected_size)
+    : blocks_(std::max<int64_t>(1, expected_size * kBitsPerKey /
+                                       (kWordsPerBlock * 64))) {}
+
+void BloomFilter::Insert(int64_t key) {
+  uint64_t key_hash = Mix(key);
+  Block& block = blocks_[GetBlockIndex(key_hash)];
+  for (int index = 0; index < kWordsPerBlock; index++) {
+    uint64_t mask = GetMask(key_hash, index);
+    // Most of the words already have the bits late in the build, and
+    // plain load is much cheaper than fetch_or
+    if ((block.words[index].load(std::memory_order_relaxed) & mask) != mask) {
+      block.words[index].fetch_or(mask, std::memory_order_relaxed);
+    }
+  }
+}
+
+bool BloomFilter::MayContain(int64_t key) const {
+  uint64_t key_hash = Mix(key);
+  const Block& block = blocks_[GetBlockIndex(key_hash)];
+  for (int index = 0; index < kWordsPerBlock; index++) {
+    uint64_t mask = GetMask(key_hash, index);
+    if ((block.words[index].load(std::memory_order_relaxed) & mask) != mask) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int64_t BloomFilter::GetMemoryUsage() const {
+  return blocks_.size() * sizeof(Block);
+}
+
+uint64_t BloomFilter::Mix(int64_t key) {
+  // Hashes modulo m are far from random in their high bits.
+  auto result = uint64_t(key);
+  result = (result ^ (result >> 30u)) * 0xbf58476d1ce4e5b9ull;
+  result = (result ^ (result >> 27u)) * 0x94d049bb133111ebull;
+  return result ^ (result >> 31u);
+}
+
+uint64_t BloomFilter::GetMask(uint32_t key_hash, int word_index) {
+  uint32_t low_bit = (key_hash * kSalts[2 * word_index]) >> 27u;
+  uint32_t high_bit = (key_hash * kSalts[2 * word_index + 1]) >> 27u;
+  return (1ull << low_bit) | (1ull << (32u + high_bit));
+}
+
+uint64_t BloomFilter::GetBlockIndex(uint64_t key_hash) const {
+  return ((key_hash >> 32u) * blocks_.size()) >> 32u;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Split block Bloom filter: every key sets one bit in each of the eight
+// 32-bit lanes of a single 32-byte block, so any lookup touches one cache
+// line. Keys can be inserted from several threads at once.
+class BloomFilter {
+ public:
+  static const int64_t kBitsPerKey = 12;
+
+  explicit BloomFilter(int64_t expected_size);
+
+  void Insert(int64_t key);
+  bool MayContain(int64_t key) const;
+
+  int64_t GetMemoryUsage() const;
+
+ private:
+  // Two lanes share one word, so insertion needs half as many atomic ops.
+  static const int kWordsPerBlock = 4;
+
+  struct alignas(32) Block {
+    std::atomic<uint64_t> words[kWordsPerBlock];
+  };
+
+ private:
+  static uint64_t Mix(int64_t key);
+  static uint64_t GetMask(uint32_t key_hash, int word_index);
+  uint64_t GetBlockIndex(uint64_t key_hash) const;
+
+ private:
+  std::vector<Block> blocks_;
+};
@@ -1,10 +1,88 @@
 #include "hash.h"
 
+#include <utility>
+
+template<typename Alphabet>
 std::string FindCollision(const std::string& a, int64_t p, int64_t m,
                           uint8_t concurrency) {
-  HashCollisionSearcher hash_collision_searcher(p, m);
+  HashCollisionSearcher<Alphabet> hash_collision_searcher(p, m);
+
+  int64_t length = hash_collision_searcher.EstimateStringLength();
+  std::string result;
+  while (result.empty()) {
+    result = hash_collision_searcher.FindCollision(a, length, concurrency);
+    length++;
+  }
+
+  return result;
+}
+
+template<typename Alphabet>
+std::vector<std::string> FindCollisions(const std::vector<std::string>& targets,
+                                        int64_t p, int64_t m,
+                                        uint8_t concurrency) {
+  HashCollisionSearcher<Alphabet> hash_collision_searcher(p, m);
+
+  std::vector<std::string> results(targets.size());
+  std::vector<size_t> remaining(targets.size());
+  for (size_t index = 0; index < targets.size(); index++) {
+    remaining[index] = index;
+  }
+
+  int64_t length = hash_collision_searcher.EstimateStringLength();
+  while (!remaining.empty()) {
+    std::vector<std::string> remaining_targets;
+    remaining_targets.reserve(remaining.size());
+    for (size_t index : remaining) {
+      remaining_targets.push_back(targets[index]);
+    }
+
+    auto found = hash_collision_searcher.FindCollisions(remaining_targets,
+                                                       length, concurrency);
+
+    std::vector<size_t> not_found;
+    for (size_t index = 0; index < remaining.size(); index++) {
+      if (found[index].empty()) {
+        not_found.push_back(remaining[index]);
+      } else {
+        results[remaining[index]] = std::move(found[index]);
+      }
+    }
+    remaining = std::move(not_found);
+    length++;
+  }
+
+  return results;
+}
+
+template<typename Alphabet>
+std::vector<std::string> FindManyCollisions(const std::string& a,
+                                            int64_t p, int64_t m,
+                                            int64_t count, int64_t max_length,
+                                            uint8_t concurrency) {
+  HashCollisionSearcher<Alphabet> hash_collision_searcher(p, m);
+
+  std::vector<std::string> results;
+  auto callback = [&results](const auto& collision) {
+    results.push_back(collision.value);
+  };
+
+  int64_t length = hash_collision_searcher.EstimateStringLength();
+  for (; length <= max_length && int64_t(results.size()) < count; length++) {
+    hash_collision_searcher.FindAllCollisions(
+        a, length, count - results.size(), concurrency, callback);
+  }
 
-  int length = 0;
+  return results;
+}
+
+template<typename Alphabet>
+std::string FindDoubleCollision(const std::string& a, HashParameters first,
+                                HashParameters second, uint8_t concurrency) {
+  DoubleHashCollisionSearcher<Alphabet> hash_collision_searcher(first,
+                                                                second);
+
+  int64_t length = hash_collision_searcher.EstimateStringLength();
   std::string result;
   while (result.empty()) {
     result = hash_collision_searcher.FindCollision(a, length, concurrency);
@@ -13,3 +91,35 @@ std::string FindCollision(const std::string& a, int64_t p, int64_t m,
 
   return result;
 }
+
+#define INSTANTIATE_FIND_COLLISION(Alphabet)                                  \
+  template std::string FindCollision<Alphabet>(                               \
+      const std::string& a, int64_t p, int64_t m, uint8_t concurrency);       \
+  template std::vector<std::string> FindCollisions<Alphabet>(                 \
+      const std::vector<std::string>& targets, int64_t p, int64_t m,          \
+      uint8_t concurrency);                                                   \
+  template std::vector<std::string> FindManyCollisions<Alphabet>(             \
+      const std::string& a, int64_t p, int64_t m, int64_t count,              \
+      int64_t max_length, uint8_t concurrency);                               \
+  template std::string FindDoubleCollision<Alphabet>(                         \
+      const std::string& a, HashParameters first, HashParameters second,      \
+      uint8_t concurrency);
+
+INSTANTIATE_FIND_COLLISION(LowercaseAlphabet)
+INSTANTIATE_FIND_COLLISION(BinaryAlphabet)
+INSTANTIATE_FIND_COLLISION(HexAlphabet)
+INSTANTIATE_FIND_COLLISION(PrintableAlphabet)
+
+std::string FindShardedCollision(const std::string& a, int64_t p, int64_t m,
+                                 std::vector<int> shard_fds) {
+  ShardedCollisionSearcher hash_collision_searcher(p, m, std::move(shard_fds));
+
+  int64_t length = hash_collision_searcher.EstimateStringLength();
+  std::string result;
+  while (result.empty()) {
+    result = hash_collision_searcher.FindCollision(a, length);
+    length++;
+  }
+
+  return result;
+}
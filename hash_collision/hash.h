@@ -1,8 +1,36 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include "hash_collision_searcher.h"
+#include "sharded_collision_searcher.h"
 
+// Strings a and the result consist of Alphabet characters, and hash
+// is computed with the Alphabet digits.
+template<typename Alphabet = LowercaseAlphabet>
 std::string FindCollision(const std::string& a, int64_t p, int64_t m,
                           uint8_t concurrency);
+
+template<typename Alphabet = LowercaseAlphabet>
+std::vector<std::string> FindCollisions(const std::vector<std::string>& targets,
+                                        int64_t p, int64_t m,
+                                        uint8_t concurrency);
+
+// Finds up to count distinct strings, which collide with a. Returns less
+// of them only if there are no more collisions of length 2 * max_length.
+template<typename Alphabet = LowercaseAlphabet>
+std::vector<std::string> FindManyCollisions(const std::string& a,
+                                            int64_t p, int64_t m,
+                                            int64_t count, int64_t max_length,
+                                            uint8_t concurrency);
+
+// Finds string, which collides with a under both hash functions.
+template<typename Alphabet = LowercaseAlphabet>
+std::string FindDoubleCollision(const std::string& a, HashParameters first,
+                                HashParameters second, uint8_t concurrency);
+
+// Same as FindCollision, but suffix tables are split between ShardWorker
+// processes, which are connected to shard_fds. Takes ownership of them.
+std::string FindShardedCollision(const std::string& a, int64_t p, int64_t m,
+                                 std::vector<int> shard_fds);
@@ -1,6 +1,8 @@
 #include "benchmark/benchmark.h"
 
+#include "bloom_filter.h"
 #include "hash.h"
+#include "worker_team.h"
 
 const int64_t kPower = 31;
 
@@ -25,4 +27,257 @@ BENCHMARK(BM_Hash)->Unit(benchmark::kMillisecond)->MinTime(5)
                    {10'000'019, 1'000'000'411, 10'000'000'033,
                     100'000'000'003, 1'000'000'000'039, 10'000'000'000'019}});
 
+static void BM_HashBatch(benchmark::State& state) {
+  static std::random_device random_device;
+  static std::mt19937_64 generator(random_device());
+
+  std::vector<std::string> targets(state.range(2), std::string(1000, 'a'));
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    for (auto& target : targets) {
+      RandomizeString(&generator, &target);
+    }
+    state.ResumeTiming();
+    auto result = FindCollisions(targets,
+                                 kPower,
+                                 state.range(1),
+                                 state.range(0));
+  }
+  state.SetItemsProcessed(state.iterations() * targets.size());
+}
+BENCHMARK(BM_HashBatch)->Unit(benchmark::kMillisecond)
+    ->ArgsProduct({{1, 4, 8},
+                   {1'000'000'411, 1'000'000'000'039},
+                   {1, 100, 1000}});
+
+static void BM_HashPrefilter(benchmark::State& state) {
+  static std::random_device random_device;
+  static std::mt19937_64 generator(random_device());
+
+  std::string target(1000, 'a');
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    RandomizeString(&generator, &target);
+    state.ResumeTiming();
+
+    HashCollisionSearcher searcher(kPower, state.range(1));
+    searcher.SetPrefilterEnabled(state.range(2));
+    std::string result;
+    for (int64_t length = searcher.EstimateStringLength(); result.empty();
+         length++) {
+      result = searcher.FindCollision(target, length, state.range(0));
+    }
+  }
+}
+BENCHMARK(BM_HashPrefilter)->Unit(benchmark::kMillisecond)->MinTime(5)
+    ->ArgsProduct({{1, 4, 8},
+                   {1'000'000'411, 100'000'000'003, 10'000'000'000'019},
+                   {0, 1}});
+
+template<typename Alphabet>
+static void BM_HashAlphabet(benchmark::State& state) {
+  static std::random_device random_device;
+  static std::mt19937_64 generator(random_device());
+
+  std::string target(1000, ' ');
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    RandomizeString<Alphabet>(&generator, &target);
+    state.ResumeTiming();
+    auto result = FindCollision<Alphabet>(target,
+                                          kPower,
+                                          state.range(1),
+                                          state.range(0));
+    state.counters["length"] = result.size();
+  }
+}
+BENCHMARK_TEMPLATE(BM_HashAlphabet, BinaryAlphabet)
+    ->Unit(benchmark::kMillisecond)
+    ->ArgsProduct({{1, 8}, {1'000'000'411, 1'000'000'000'039}});
+BENCHMARK_TEMPLATE(BM_HashAlphabet, HexAlphabet)
+    ->Unit(benchmark::kMillisecond)
+    ->ArgsProduct({{1, 8}, {1'000'000'411, 1'000'000'000'039}});
+BENCHMARK_TEMPLATE(BM_HashAlphabet, LowercaseAlphabet)
+    ->Unit(benchmark::kMillisecond)
+    ->ArgsProduct({{1, 8}, {1'000'000'411, 1'000'000'000'039}});
+BENCHMARK_TEMPLATE(BM_HashAlphabet, PrintableAlphabet)
+    ->Unit(benchmark::kMillisecond)
+    ->ArgsProduct({{1, 8}, {1'000'000'411, 1'000'000'000'039}});
+
+static void BM_BloomFilter(benchmark::State& state) {
+  static std::mt19937_64 generator(42);
+
+  int64_t size = state.range(0);
+  BloomFilter filter(size);
+  for (int64_t index = 0; index < size; index++) {
+    filter.Insert(generator());
+  }
+
+  std::vector<int64_t> keys(1 << 16);
+  for (auto& key : keys) {
+    key = generator();
+  }
+
+  int64_t positives = 0;
+  int64_t probes = 0;
+  for (auto _ : state) {
+    for (int64_t key : keys) {
+      positives += filter.MayContain(key);
+    }
+    probes += keys.size();
+  }
+
+  state.SetItemsProcessed(probes);
+  state.counters["false_positive_rate"] = double(positives) / probes;
+  state.counters["bytes"] = filter.GetMemoryUsage();
+  state.counters["bits_per_key"] = 8.0 * filter.GetMemoryUsage() / size;
+}
+BENCHMARK(BM_BloomFilter)->Arg(26 * 26 * 26)->Arg(26 * 26 * 26 * 26)
+    ->Arg(26 * 26 * 26 * 26 * 26);
+
+static void BM_HashMapMiss(benchmark::State& state) {
+  static std::mt19937_64 generator(42);
+
+  int64_t size = state.range(0);
+  HashMap hash_map(size, {static_cast<PageMode>(state.range(1))});
+  HashString string(kPower, 1'000'000'000'039, 5);
+  for (int64_t index = 0; index < size; index++, ++string) {
+    hash_map.Insert(string);
+  }
+
+  std::vector<int64_t> keys(1 << 16);
+  for (auto& key : keys) {
+    key = generator() % 1'000'000'000'039;
+  }
+
+  for (auto _ : state) {
+    for (int64_t key : keys) {
+      benchmark::DoNotOptimize(hash_map.FindCode(key));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * keys.size());
+  state.counters["bytes"] = size * (sizeof(int64_t) + sizeof(HashMap::Entry));
+}
+// Second argument is PageMode: default, transparent or explicit huge pages
+BENCHMARK(BM_HashMapMiss)
+    ->ArgsProduct({{26 * 26 * 26, 26 * 26 * 26 * 26, 26 * 26 * 26 * 26 * 26},
+                   {0, 1, 2}});
+
+static void BM_HashStats(benchmark::State& state) {
+  static std::random_device random_device;
+  static std::mt19937_64 generator(random_device());
+
+  std::string target(1000, 'a');
+  SearchStats stats;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    RandomizeString(&generator, &target);
+    state.ResumeTiming();
+
+    HashCollisionSearcher searcher(kPower, state.range(1));
+    searcher.SetStats(&stats);
+    std::string result;
+    for (int64_t length = searcher.EstimateStringLength(); result.empty();
+         length++) {
+      result = searcher.FindCollision(target, length, state.range(0));
+    }
+  }
+
+  // Times of a length are its sums over the searches, so the counters
+  // are per iteration, like the time of the benchmark.
+  double iterations = state.iterations();
+  std::vector<double> lock_wait_seconds;
+  std::vector<int64_t> probes;
+  std::vector<double> probe_seconds;
+  for (const auto& length_stats : stats.lengths) {
+    std::string suffix = "_" + std::to_string(length_stats.length);
+    state.counters["build_ms" + suffix] =
+        1000 * length_stats.build_seconds / iterations;
+    state.counters["probe_ms" + suffix] =
+        1000 * length_stats.probe_seconds / iterations;
+
+    const auto& build_threads = length_stats.build_threads;
+    lock_wait_seconds.resize(
+        std::max(lock_wait_seconds.size(), build_threads.size()));
+    for (size_t thread = 0; thread < build_threads.size(); thread++) {
+      lock_wait_seconds[thread] += build_threads[thread].lock_wait_seconds;
+    }
+    const auto& probe_threads = length_stats.probe_threads;
+    probes.resize(std::max(probes.size(), probe_threads.size()));
+    probe_seconds.resize(probes.size());
+    for (size_t thread = 0; thread < probe_threads.size(); thread++) {
+      probes[thread] += probe_threads[thread].strings;
+      probe_seconds[thread] += probe_threads[thread].seconds;
+    }
+  }
+
+  // Slowest thread bounds the build, so the maximum of them is reported.
+  double max_lock_wait_seconds = 0;
+  for (double seconds : lock_wait_seconds) {
+    max_lock_wait_seconds = std::max(max_lock_wait_seconds, seconds);
+  }
+  state.counters["max_lock_wait_ms"] =
+      1000 * max_lock_wait_seconds / iterations;
+  for (size_t thread = 0; thread < probes.size(); thread++) {
+    state.counters["probes_per_second_" + std::to_string(thread)] =
+        probe_seconds[thread] != 0 ? probes[thread] / probe_seconds[thread]
+                                   : 0;
+  }
+
+  // Chain lengths of the largest table, the last one counts the longer
+  // chains too. Lengths are padded, so the counters are printed in order.
+  const TableStats& table = stats.lengths.back().table;
+  int64_t buckets = 0;
+  for (size_t length = 0; length < table.bucket_histogram.size(); length++) {
+    buckets += table.bucket_histogram[length];
+    std::string name = (length < 10 ? "chains_0" : "chains_") +
+                       std::to_string(length);
+    state.counters[name] = table.bucket_histogram[length];
+  }
+  state.counters["entries"] = table.entries;
+  state.counters["bytes"] = table.bytes;
+  state.counters["filter_bytes"] = table.filter_bytes;
+  state.counters["mean_chain"] =
+      buckets != 0 ? static_cast<double>(table.entries) / buckets : 0;
+}
+BENCHMARK(BM_HashStats)->Unit(benchmark::kMillisecond)
+    ->ArgsProduct({{1, 4, 8},
+                   {1'000'000'411, 100'000'000'003, 10'000'000'000'019}});
+
+// Cost of an empty phase: second argument 0 starts and joins the threads,
+// as the searcher did for every phase, 1 runs a phase of a WorkerTeam.
+static void BM_PhaseStart(benchmark::State& state) {
+  int thread_count = state.range(0);
+  std::atomic<int64_t> counter(0);
+  auto work = [&counter](int thread_index) {
+    counter.fetch_add(thread_index, std::memory_order_relaxed);
+  };
+
+  if (state.range(1) == 0) {
+    for (auto _ : state) {
+      std::vector<std::thread> threads;
+      threads.reserve(thread_count);
+      for (int index = 0; index < thread_count; index++) {
+        threads.emplace_back(work, index);
+      }
+      for (auto& thread : threads) {
+        thread.join();
+      }
+    }
+  } else {
+    WorkerTeam team(thread_count, false);
+    std::function<void(int)> function = work;
+    for (auto _ : state) {
+      team.Run(function);
+    }
+  }
+  benchmark::DoNotOptimize(counter.load());
+}
+BENCHMARK(BM_PhaseStart)->UseRealTime()->Unit(benchmark::kMicrosecond)
+    ->ArgsProduct({{1, 4, 8}, {0, 1}});
+
 BENCHMARK_MAIN();
@@ -1,96 +1,491 @@
 #include "hash_collision_searcher.h"
 
-HashCollisionSearcher::HashCollisionSearcher(int64_t power, int64_t module)
-    : power_(power), module_(module), is_answer_found_(false) {}
+#include <algorithm>
+#include <chrono>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const int64_t kMaxHistogramLength = 16;
+
+double SecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void AddThreadStats(const std::vector<ThreadStats>& thread_stats,
+                    std::vector<ThreadStats>* total) {
+  if (total->size() < thread_stats.size()) {
+    total->resize(thread_stats.size());
+  }
+  for (size_t index = 0; index < thread_stats.size(); index++) {
+    (*total)[index].strings += thread_stats[index].strings;
+    (*total)[index].seconds += thread_stats[index].seconds;
+    (*total)[index].lock_wait_seconds +=
+        thread_stats[index].lock_wait_seconds;
+  }
+}
+
+}  // namespace
+
+template<typename Alphabet, typename Hasher>
+int64_t HashCollisionSearcher<Alphabet, Hasher>::EstimateStringLength()
+    const {
+  return ::EstimateStringLength<Alphabet>(hasher_.GetKeyCount());
+}
+
+template<typename Alphabet, typename Hasher>
+std::string HashCollisionSearcher<Alphabet, Hasher>::FindCollision(
+    const std::string& target, int64_t string_length, uint8_t concurrency) {
+  PrepareTables(string_length, concurrency);
 
-std::string HashCollisionSearcher::FindCollision(const std::string& target,
-                                                 int64_t string_length,
-                                                 uint8_t concurrency) {
   target_ = target;
-  hash_maps_.emplace_back();
-  target_hash_ = Hash(target, power_, module_);
+  target_key_ = hasher_.GetKey(target);
   is_answer_found_.store(false);
 
-  GenerateAllStrings(string_length, concurrency);
+  auto start = Clock::now();
   SearchForCollision(string_length, concurrency);
+  if (stats_ != nullptr) {
+    stats_->GetLength(string_length).probe_seconds += SecondsSince(start);
+  }
 
   return is_answer_found_.load() ? result_ : "";
 }
 
-bool HashCollisionSearcher::CheckString(const HashString& string) {
-  int64_t shifted_hash = string.GetHash();
+template<typename Alphabet, typename Hasher>
+std::vector<std::string>
+HashCollisionSearcher<Alphabet, Hasher>::FindCollisions(
+    const std::vector<std::string>& targets, int64_t string_length,
+    uint8_t concurrency) {
+  std::vector<std::string> results(targets.size());
+  if (targets.size() < concurrency) {
+    // Not enough targets to keep all threads busy, so every target
+    // is searched by all threads.
+    for (size_t index = 0; index < targets.size(); index++) {
+      results[index] = FindCollision(targets[index], string_length,
+                                     concurrency);
+    }
+    return results;
+  }
+
+  PrepareTables(string_length, concurrency);
+
+  auto start = Clock::now();
+  auto segments = SplitIntoSegments(0, targets.size() - 1, concurrency);
+
+  std::vector<ThreadStats> thread_stats(segments.size());
+
+  GetTeam(concurrency).Run([&](int thread_index) {
+    if (thread_index >= int(segments.size())) {
+      return;
+    }
+    auto thread_start = Clock::now();
+    int numa_node = GetCurrentNumaNode();
+    const auto& segment = segments[thread_index];
+    for (int64_t index = segment.first; index <= segment.second; index++) {
+      results[index] =
+          FindTargetCollision(targets[index], string_length, numa_node,
+                              &thread_stats[thread_index]);
+    }
+    thread_stats[thread_index].seconds = SecondsSince(thread_start);
+  });
+  RecordProbe(string_length, start, thread_stats);
+  return results;
+}
+
+template<typename Alphabet, typename Hasher>
+int64_t HashCollisionSearcher<Alphabet, Hasher>::FindAllCollisions(
+    const std::string& target, int64_t string_length, int64_t max_count,
+    uint8_t concurrency, const CollisionCallback& callback) {
+  if (max_count <= 0) {
+    return 0;
+  }
+  PrepareTables(string_length, concurrency);
 
-  for (int length = 0; length < hash_maps_.size(); length++) {
-    int64_t right_hash = (target_hash_ - shifted_hash + module_) % module_;
-    std::string right_string = hash_maps_[length].Find(right_hash);
+  CollisionStream stream;
+  stream.target = target;
+  stream.target_key = hasher_.GetKey(target);
+  stream.max_count = max_count;
+  stream.callback = &callback;
 
-    if (!right_string.empty() && string.Get() + right_string != target_) {
-      if (!is_answer_found_.exchange(true)) {
-        std::lock_guard lock_guard(result_mutex_);
-        result_ = string.Get() + right_string;
-      }
-      return true;
+  auto start = Clock::now();
+  int64_t max_value = BinaryPow(Alphabet::kSize, string_length) - 1;
+
+  auto segments = SplitIntoSegments(0, max_value, concurrency);
+
+  std::vector<ThreadStats> thread_stats(segments.size());
+
+  GetTeam(concurrency).Run([&](int thread_index) {
+    if (thread_index >= int(segments.size())) {
+      return;
     }
+    auto thread_start = Clock::now();
+    StreamStrings(string_length, segments[thread_index].first,
+                  segments[thread_index].second, &stream,
+                  &thread_stats[thread_index]);
+    thread_stats[thread_index].seconds = SecondsSince(thread_start);
+  });
+  RecordProbe(string_length, start, thread_stats);
+  return stream.found.size();
+}
+
+template<typename Alphabet, typename Hasher>
+bool HashCollisionSearcher<Alphabet, Hasher>::SaveTable(
+    int64_t length, const std::string& path) const {
+  auto it = hash_maps_.find(length);
+  if (it == hash_maps_.end()) {
+    return false;
+  }
+  return ::SaveTable(path, GetTableParameters(length), *it->second.hash_map);
+}
+
+template<typename Alphabet, typename Hasher>
+bool HashCollisionSearcher<Alphabet, Hasher>::LoadTable(
+    int64_t length, const std::string& path) {
+  auto hash_map = ::LoadTable(path, GetTableParameters(length));
+  if (hash_map == nullptr) {
+    return false;
+  }
+  std::unique_ptr<BloomFilter> filter;
+  if (is_prefilter_enabled_) {
+    filter = std::make_unique<BloomFilter>(hash_map->GetSize());
+    const HashMap::Entry* entries = hash_map->GetEntries();
+    for (int64_t index = 0; index < hash_map->GetSize(); index++) {
+      filter->Insert(entries[index].hash);
+    }
+  }
+
+  auto it = hash_maps_.insert_or_assign(
+      length, SuffixTable{hasher_.GetShift(length), std::move(hash_map),
+                          std::move(filter)}).first;
+  ReplicateTable(&it->second);
+  return true;
+}
 
-    shifted_hash = (__int128_t(shifted_hash) * power_) % module_;
+template<typename Alphabet, typename Hasher>
+void HashCollisionSearcher<Alphabet, Hasher>::SetTablesDirectory(
+    const std::string& directory) {
+  tables_directory_ = directory;
+}
+
+template<typename Alphabet, typename Hasher>
+void HashCollisionSearcher<Alphabet, Hasher>::SetPrefilterEnabled(
+    bool is_enabled) {
+  is_prefilter_enabled_ = is_enabled;
+}
+
+template<typename Alphabet, typename Hasher>
+void HashCollisionSearcher<Alphabet, Hasher>::SetMemoryPolicy(
+    const MemoryPolicy& policy) {
+  memory_policy_ = policy;
+}
+
+template<typename Alphabet, typename Hasher>
+void HashCollisionSearcher<Alphabet, Hasher>::SetStats(SearchStats* stats) {
+  stats_ = stats;
+}
+
+template<typename Alphabet, typename Hasher>
+TableParameters HashCollisionSearcher<Alphabet, Hasher>::GetTableParameters(
+    int64_t length) const {
+  return hasher_.GetTableParameters(length);
+}
+
+template<typename Alphabet, typename Hasher>
+std::string HashCollisionSearcher<Alphabet, Hasher>::GetTablePath(
+    int64_t length) const {
+  return tables_directory_ + "/table_" + Alphabet::kName + "_" +
+         hasher_.GetName() + "_" + std::to_string(length) + ".bin";
+}
+
+template<typename Alphabet, typename Hasher>
+void HashCollisionSearcher<Alphabet, Hasher>::PrepareTables(
+    int64_t length, uint8_t concurrency) {
+  hash_maps_.erase(hash_maps_.begin(),
+                   hash_maps_.lower_bound(length - kKeptTableCount + 1));
+  hash_maps_.erase(hash_maps_.upper_bound(length), hash_maps_.end());
+
+  if (hash_maps_.count(length) != 0) {
+    return;
+  }
+
+  auto start = Clock::now();
+  if (!tables_directory_.empty() && LoadTable(length, GetTablePath(length))) {
+    if (stats_ != nullptr) {
+      stats_->GetLength(length).load_seconds += SecondsSince(start);
+      RecordTable(length);
+    }
+    return;
+  }
+
+  int64_t size = BinaryPow(Alphabet::kSize, length);
+  hash_maps_.insert_or_assign(
+      length, SuffixTable{hasher_.GetShift(length),
+                          std::make_unique<HashMap>(size, memory_policy_),
+                          is_prefilter_enabled_
+                              ? std::make_unique<BloomFilter>(size)
+                              : nullptr});
+  GenerateAllStrings(length, concurrency);
+  ReplicateTable(&hash_maps_.at(length));
+  if (stats_ != nullptr) {
+    stats_->GetLength(length).build_seconds += SecondsSince(start);
+    RecordTable(length);
+  }
+
+  if (!tables_directory_.empty()) {
+    SaveTable(length, GetTablePath(length));
+  }
+}
+
+template<typename Alphabet, typename Hasher>
+void HashCollisionSearcher<Alphabet, Hasher>::ReplicateTable(
+    SuffixTable* table) const {
+  int node_count = GetNumaNodeCount();
+  if (memory_policy_.numa != NumaMode::kReplicate || node_count <= 1) {
+    return;
+  }
+  // The table, which was built or mapped, is released, so there are only
+  // node_count copies of it.
+  table->hash_map =
+      std::make_unique<HashMap>(*table->hash_map, memory_policy_, 0);
+  for (int node = 1; node < node_count; node++) {
+    table->replicas.push_back(
+        std::make_unique<HashMap>(*table->hash_map, memory_policy_, node));
+  }
+}
+
+template<typename Alphabet, typename Hasher>
+void HashCollisionSearcher<Alphabet, Hasher>::RecordTable(
+    int64_t length) const {
+  const SuffixTable& table = hash_maps_.at(length);
+  TableStats& table_stats = stats_->GetLength(length).table;
+
+  table_stats.entries = table.hash_map->GetSize();
+  table_stats.bytes = table.hash_map->GetMemoryUsage();
+  for (const auto& replica : table.replicas) {
+    table_stats.bytes += replica->GetMemoryUsage();
+  }
+  table_stats.filter_bytes =
+      table.filter != nullptr ? table.filter->GetMemoryUsage() : 0;
+  table_stats.bucket_histogram =
+      table.hash_map->GetBucketHistogram(kMaxHistogramLength);
+}
+
+template<typename Alphabet, typename Hasher>
+void HashCollisionSearcher<Alphabet, Hasher>::RecordProbe(
+    int64_t length, std::chrono::steady_clock::time_point start,
+    const std::vector<ThreadStats>& thread_stats) const {
+  if (stats_ == nullptr) {
+    return;
+  }
+  LengthStats& length_stats = stats_->GetLength(length);
+  length_stats.probe_seconds += SecondsSince(start);
+  AddThreadStats(thread_stats, &length_stats.probe_threads);
+}
+
+template<typename Alphabet, typename Hasher>
+WorkerTeam& HashCollisionSearcher<Alphabet, Hasher>::GetTeam(
+    uint8_t concurrency) {
+  int thread_count = std::max<int>(concurrency, 1);
+  if (team_ == nullptr || team_->GetThreadCount() != thread_count ||
+      team_->ArePinned() != memory_policy_.pin_threads) {
+    team_.reset();
+    team_ = std::make_unique<WorkerTeam>(thread_count,
+                                         memory_policy_.pin_threads);
+  }
+  return *team_;
+}
+
+template<typename Alphabet, typename Hasher>
+const HashMap&
+HashCollisionSearcher<Alphabet, Hasher>::SuffixTable::GetHashMap(
+    int numa_node) const {
+  int node = numa_node % (replicas.size() + 1);
+  return node == 0 ? *hash_map : *replicas[node - 1];
+}
+
+template<typename Alphabet, typename Hasher>
+bool HashCollisionSearcher<Alphabet, Hasher>::CheckString(
+    const typename Hasher::String& string, const std::string& target,
+    int64_t target_key, int numa_node, std::string* result) {
+  // The longest table goes first, as it has the best chance to contain answer.
+  for (auto it = hash_maps_.rbegin(); it != hash_maps_.rend(); ++it) {
+    SuffixTable& table = it->second;
+    int64_t right_key = hasher_.GetSuffixKey(string, table.shift, target_key);
+    if (table.filter != nullptr && !table.filter->MayContain(right_key)) {
+      continue;
+    }
+    int64_t right_code = table.GetHashMap(numa_node).FindCode(right_key);
+    if (right_code == HashMap::kNoEntry) {
+      continue;
+    }
+
+    std::string collision =
+        string.Get() + DecodeString<Alphabet>(right_code);
+    if (!collision.empty() && collision != target) {
+      *result = collision;
+      return true;
+    }
   }
   return false;
 }
 
-void HashCollisionSearcher::CheckStrings(int64_t length,
-                                         int64_t from, int64_t to) {
-  HashString string(power_, module_, length, from);
+template<typename Alphabet, typename Hasher>
+void HashCollisionSearcher<Alphabet, Hasher>::CheckStrings(
+    int64_t length, int64_t from, int64_t to, ThreadStats* thread_stats) {
+  int numa_node = GetCurrentNumaNode();
+
+  std::string result;
+  auto string = hasher_.MakeString(length, from);
   for (; from <= to; ++from, ++string) {
-    if (CheckString(string) || is_answer_found_.load()) {
+    thread_stats->strings++;
+    if (CheckString(string, target_, target_key_, numa_node, &result)) {
+      if (!is_answer_found_.exchange(true)) {
+        std::lock_guard lock_guard(result_mutex_);
+        result_ = result;
+      }
+      return;
+    }
+    if (is_answer_found_.load()) {
       return;
     }
   }
 }
 
-void HashCollisionSearcher::SearchForCollision(int64_t length,
-                                               uint8_t concurrency) {
-  int64_t max_value = BinaryPow(kAlphabetSize, length) - 1;
+template<typename Alphabet, typename Hasher>
+void HashCollisionSearcher<Alphabet, Hasher>::StreamStrings(
+    int64_t length, int64_t from, int64_t to, CollisionStream* stream,
+    ThreadStats* thread_stats) {
+  int numa_node = GetCurrentNumaNode();
 
-  auto segments = SplitIntoSegments(0, max_value, concurrency);
+  auto string = hasher_.MakeString(length, from);
+  for (int64_t value = from; value <= to; ++value, ++string) {
+    if (stream->is_finished.load()) {
+      return;
+    }
+    thread_stats->strings++;
 
-  std::vector<std::thread> threads;
+    for (auto it = hash_maps_.rbegin(); it != hash_maps_.rend(); ++it) {
+      const SuffixTable& table = it->second;
+      int64_t right_key =
+          hasher_.GetSuffixKey(string, table.shift, stream->target_key);
+      if (table.filter != nullptr && !table.filter->MayContain(right_key)) {
+        continue;
+      }
 
-  threads.reserve(segments.size());
-  for (const auto& segment : segments) {
-    threads.emplace_back([this, length, segment] {
-      CheckStrings(length, segment.first, segment.second);
-    });
-  }
+      table.GetHashMap(numa_node).ForEachCode(right_key, [&](int64_t code) {
+        Collision collision{value, code,
+                            string.Get() + DecodeString<Alphabet>(code)};
+        if (collision.value.empty() || collision.value == stream->target) {
+          return;
+        }
 
-  for (auto& thread : threads) {
-    thread.join();
+        std::lock_guard lock_guard(stream->mutex);
+        if (stream->is_finished.load() ||
+            !stream->found.insert(collision.value).second) {
+          return;
+        }
+        (*stream->callback)(collision);
+        if (int64_t(stream->found.size()) >= stream->max_count) {
+          stream->is_finished.store(true);
+        }
+      });
+    }
   }
 }
 
-void HashCollisionSearcher::CreateStrings(int64_t length,
-                                          int64_t from, int64_t to) {
-  HashString string(power_, module_, length, from);
-  for (; from <= to; ++from, ++string) {
-    hash_maps_[length].Insert(string);
+template<typename Alphabet, typename Hasher>
+std::string HashCollisionSearcher<Alphabet, Hasher>::FindTargetCollision(
+    const std::string& target, int64_t length, int numa_node,
+    ThreadStats* thread_stats) {
+  int64_t target_key = hasher_.GetKey(target);
+  int64_t max_value = BinaryPow(Alphabet::kSize, length) - 1;
+
+  std::string result;
+  auto string = hasher_.MakeString(length);
+  for (int64_t value = 0; value <= max_value; ++value, ++string) {
+    thread_stats->strings++;
+    if (CheckString(string, target, target_key, numa_node, &result)) {
+      break;
+    }
   }
+  return result;
 }
 
-void HashCollisionSearcher::GenerateAllStrings(int64_t length,
-                                               uint8_t concurrency) {
-  int64_t max_value = BinaryPow(kAlphabetSize, length) - 1;
+template<typename Alphabet, typename Hasher>
+void HashCollisionSearcher<Alphabet, Hasher>::SearchForCollision(
+    int64_t length, uint8_t concurrency) {
+  int64_t max_value = BinaryPow(Alphabet::kSize, length) - 1;
 
   auto segments = SplitIntoSegments(0, max_value, concurrency);
 
-  std::vector<std::thread> threads;
+  std::vector<ThreadStats> thread_stats(segments.size());
 
-  threads.reserve(segments.size());
-  for (const auto& segment : segments) {
-    threads.emplace_back([this, length, segment] {
-      CreateStrings(length, segment.first, segment.second);
-    });
+  GetTeam(concurrency).Run([&](int thread_index) {
+    if (thread_index >= int(segments.size())) {
+      return;
+    }
+    auto thread_start = Clock::now();
+    CheckStrings(length, segments[thread_index].first,
+                 segments[thread_index].second, &thread_stats[thread_index]);
+    thread_stats[thread_index].seconds = SecondsSince(thread_start);
+  });
+  if (stats_ != nullptr) {
+    AddThreadStats(thread_stats, &stats_->GetLength(length).probe_threads);
   }
+}
+
+template<typename Alphabet, typename Hasher>
+void HashCollisionSearcher<Alphabet, Hasher>::CreateStrings(
+    int64_t length, int64_t from, int64_t to, ThreadStats* thread_stats) {
+  std::chrono::nanoseconds lock_wait(0);
+  SuffixTable& table = hash_maps_.at(length);
+  auto string = hasher_.MakeString(length, from);
+  for (; from <= to; ++from, ++string) {
+    int64_t key = hasher_.GetKey(string);
+    table.hash_map->Insert(key, string.GetCode(), &lock_wait);
+    if (table.filter != nullptr) {
+      table.filter->Insert(key);
+    }
+    thread_stats->strings++;
+  }
+  thread_stats->lock_wait_seconds =
+      std::chrono::duration<double>(lock_wait).count();
+}
 
-  for (auto& thread : threads) {
-    thread.join();
+template<typename Alphabet, typename Hasher>
+void HashCollisionSearcher<Alphabet, Hasher>::GenerateAllStrings(
+    int64_t length, uint8_t concurrency) {
+  int64_t max_value = BinaryPow(Alphabet::kSize, length) - 1;
+
+  auto segments = SplitIntoSegments(0, max_value, concurrency);
+
+  std::vector<ThreadStats> thread_stats(segments.size());
+
+  // Worker, which inserts a segment, later probes the segment with the same
+  // index, on the same core.
+  GetTeam(concurrency).Run([&](int thread_index) {
+    if (thread_index >= int(segments.size())) {
+      return;
+    }
+    auto thread_start = Clock::now();
+    CreateStrings(length, segments[thread_index].first,
+                  segments[thread_index].second, &thread_stats[thread_index]);
+    thread_stats[thread_index].seconds = SecondsSince(thread_start);
+  });
+  if (stats_ != nullptr) {
+    AddThreadStats(thread_stats, &stats_->GetLength(length).build_threads);
   }
 }
+
+template class HashCollisionSearcher<LowercaseAlphabet>;
+template class HashCollisionSearcher<BinaryAlphabet>;
+template class HashCollisionSearcher<HexAlphabet>;
+template class HashCollisionSearcher<PrintableAlphabet>;
+template class HashCollisionSearcher<LowercaseAlphabet,
+                                     DoubleHasher<LowercaseAlphabet>>;
+template class HashCollisionSearcher<BinaryAlphabet,
+                                     DoubleHasher<BinaryAlphabet>>;
+template class HashCollisionSearcher<HexAlphabet, DoubleHasher<HexAlphabet>>;
+template class HashCollisionSearcher<PrintableAlphabet,
+                                     DoubleHasher<PrintableAlphabet>>;
@@ -1,39 +1,187 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
 #include <string>
 #include <thread>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
+#include "bloom_filter.h"
 #include "hash_map.h"
+#include "hasher.h"
+#include "search_stats.h"
+#include "table_file.h"
+#include "table_memory.h"
+#include "worker_team.h"
 #include "../utilities.h"
 
+// Alphabet of the strings, hash of the target and of the result
+// are computed with the same alphabet. Hasher maps the strings to the keys
+// of the suffix tables, see hasher.h: a collision of keys is a collision
+// of the hash, or of both hashes for DoubleHasher.
+template<typename Alphabet = LowercaseAlphabet,
+         typename Hasher = PolynomialHasher<Alphabet>>
 class HashCollisionSearcher {
  public:
-  HashCollisionSearcher(int64_t power, int64_t module);
+  struct Collision {
+    // Index of the prefix among the strings of its length.
+    int64_t prefix;
+    // Code of the suffix, see EncodeString.
+    int64_t suffix;
+    std::string value;
+  };
+
+  // Calls are serialized, so callback doesn't need any synchronization.
+  using CollisionCallback = std::function<void(const Collision& collision)>;
+
+ public:
+  // Arguments are passed to Hasher: power and module of the polynomial
+  // hash, or the HashParameters of both hashes for DoubleHasher.
+  template<typename... HasherArguments>
+  explicit HashCollisionSearcher(HasherArguments&&... hasher_arguments)
+      : hasher_(std::forward<HasherArguments>(hasher_arguments)...),
+        is_answer_found_(false) {
+  }
+
+  // See ::EstimateStringLength for the number of keys of Hasher.
+  int64_t EstimateStringLength() const;
 
   std::string FindCollision(const std::string& target, int64_t string_length,
                             uint8_t concurrency);
 
+  // Suffix tables don't depend on target, so they are built once for all
+  // targets, and each target is then searched by a single thread.
+  // Returns empty string for targets without collision of this length.
+  std::vector<std::string> FindCollisions(
+      const std::vector<std::string>& targets, int64_t string_length,
+      uint8_t concurrency);
+
+  // Doesn't stop at the first collision: every distinct collision is passed
+  // to callback, until max_count of them are found or all prefixes are
+  // checked. Returns the number of collisions found.
+  int64_t FindAllCollisions(const std::string& target, int64_t string_length,
+                            int64_t max_count, uint8_t concurrency,
+                            const CollisionCallback& callback);
+
+  // Tables don't depend on target, so they can be built once, saved
+  // and then mapped by later runs instead of being generated again.
+  bool SaveTable(int64_t length, const std::string& path) const;
+  bool LoadTable(int64_t length, const std::string& path);
+
+  // Tables are loaded from this directory when possible, and the ones
+  // that had to be built are saved there.
+  void SetTablesDirectory(const std::string& directory);
+
+  // Almost every probe misses, so each table gets a Bloom filter, which
+  // rejects most of the misses before HashMap::Find. Enabled by default.
+  void SetPrefilterEnabled(bool is_enabled);
+
+  // Huge pages, NUMA placement of tables and pinning of the threads.
+  // Applies to the tables built or loaded after the call.
+  void SetMemoryPolicy(const MemoryPolicy& policy);
+
+  // Timings, table sizes and per-thread counters of the following searches
+  // are added to stats. nullptr turns collecting off.
+  void SetStats(SearchStats* stats);
+
  private:
-  bool CheckString(const HashString& string);
-  void CheckStrings(int64_t length, int64_t from, int64_t to);
+  // All strings of some length, which are used as suffixes.
+  struct SuffixTable {
+    // Hasher::GetShift of the length.
+    typename Hasher::Shift shift;
+    std::unique_ptr<HashMap> hash_map;
+    // Contains hashes of all strings in hash_map, if prefilter is enabled.
+    std::unique_ptr<BloomFilter> filter;
+    // With NumaMode::kReplicate hash_map is the copy on node 0, and these
+    // are the copies on the other nodes.
+    std::vector<std::unique_ptr<HashMap>> replicas = {};
+
+    const HashMap& GetHashMap(int numa_node) const;
+  };
+
+  struct CollisionStream {
+    std::string target;
+    int64_t target_key;
+    int64_t max_count;
+    const CollisionCallback* callback;
+
+    std::mutex mutex;
+    std::unordered_set<std::string> found;
+    std::atomic<bool> is_finished{false};
+  };
+
+  // Tables with suffixes shorter than string_length - kKeptTableCount + 1
+  // are too small to give a noticeable chance of collision, so they are freed.
+  const int64_t kKeptTableCount = 2;
+
+ private:
+  TableParameters GetTableParameters(int64_t length) const;
+  std::string GetTablePath(int64_t length) const;
+  void PrepareTables(int64_t length, uint8_t concurrency);
+  void ReplicateTable(SuffixTable* table) const;
+  // Team of concurrency workers, which is kept between the calls, so
+  // building and probing tables of each length don't start new threads.
+  WorkerTeam& GetTeam(uint8_t concurrency);
+
+  void RecordTable(int64_t length) const;
+  void RecordProbe(int64_t length, std::chrono::steady_clock::time_point start,
+                   const std::vector<ThreadStats>& thread_stats) const;
+
+  bool CheckString(const typename Hasher::String& string,
+                   const std::string& target, int64_t target_key,
+                   int numa_node, std::string* result);
+  void CheckStrings(int64_t length, int64_t from, int64_t to,
+                    ThreadStats* thread_stats);
+  void StreamStrings(int64_t length, int64_t from, int64_t to,
+                     CollisionStream* stream, ThreadStats* thread_stats);
+  std::string FindTargetCollision(const std::string& target, int64_t length,
+                                  int numa_node, ThreadStats* thread_stats);
   void SearchForCollision(int64_t length, uint8_t concurrency);
 
-  void CreateStrings(int64_t length, int64_t from, int64_t to);
+  void CreateStrings(int64_t length, int64_t from, int64_t to,
+                     ThreadStats* thread_stats);
   void GenerateAllStrings(int64_t length, uint8_t concurrency);
 
  private:
-  int64_t power_;
-  int64_t module_;
+  Hasher hasher_;
 
-  std::vector<HashMap> hash_maps_;
+  std::map<int64_t, SuffixTable> hash_maps_;
+  std::string tables_directory_;
+  bool is_prefilter_enabled_ = true;
+  MemoryPolicy memory_policy_;
+  SearchStats* stats_ = nullptr;
 
   std::string target_;
-  int64_t target_hash_ = 0;
+  int64_t target_key_ = 0;
 
   std::string result_;
   std::mutex result_mutex_;
 
   std::atomic<bool> is_answer_found_;
+
+  std::unique_ptr<WorkerTeam> team_;
 };
+
+// Looks for strings, which collide with target under two hash functions
+// at once.
+template<typename Alphabet = LowercaseAlphabet>
+using DoubleHashCollisionSearcher =
+    HashCollisionSearcher<Alphabet, DoubleHasher<Alphabet>>;
+
+extern template class HashCollisionSearcher<LowercaseAlphabet>;
+extern template class HashCollisionSearcher<BinaryAlphabet>;
+extern template class HashCollisionSearcher<HexAlphabet>;
+extern template class HashCollisionSearcher<PrintableAlphabet>;
+extern template class HashCollisionSearcher<LowercaseAlphabet,
+                                            DoubleHasher<LowercaseAlphabet>>;
+extern template class HashCollisionSearcher<BinaryAlphabet,
+                                            DoubleHasher<BinaryAlphabet>>;
+extern template class HashCollisionSearcher<HexAlphabet,
+                                            DoubleHasher<HexAlphabet>>;
+extern template class HashCollisionSearcher<PrintableAlphabet,
+                                            DoubleHasher<PrintableAlphabet>>;
@@ -1,32 +1,139 @@
 #include "hash_map.h"
 
-HashMap::HashMap()
-    : buckets_(kBucketCount),
-      bucket_mutexes_(kMutexCount) {}
+#include <algorithm>
+#include <stdexcept>
 
-void HashMap::Insert(const HashString& value) {
-  int64_t bucket_index = value.GetHash() % buckets_.size();
+namespace {
+
+std::shared_ptr<TableMemory> AllocateTable(int64_t bucket_count,
+                                           int64_t capacity,
+                                           const MemoryPolicy& policy,
+                                           int numa_node) {
+  return std::make_shared<TableMemory>(
+      bucket_count * sizeof(int64_t) + capacity * sizeof(HashMap::Entry),
+      policy, numa_node);
+}
+
+}  // namespace
+
+HashMap::HashMap(int64_t capacity, const MemoryPolicy& policy, int numa_node)
+    : is_read_only_(false),
+      bucket_count_(std::max<int64_t>(capacity, 1)),
+      capacity_(std::max<int64_t>(capacity, 0)),
+      size_(0),
+      bucket_mutexes_(std::min<int64_t>(bucket_count_, kMutexCount)) {
+  auto memory = AllocateTable(bucket_count_, capacity_, policy, numa_node);
+  buckets_ = static_cast<int64_t*>(memory->Data());
+  entries_ = reinterpret_cast<Entry*>(buckets_ + bucket_count_);
+  storage_ = std::move(memory);
+
+  std::fill(buckets_, buckets_ + bucket_count_, kNoEntry);
+}
+
+HashMap::HashMap(const HashMap& other, const MemoryPolicy& policy,
+                 int numa_node)
+    : is_read_only_(true),
+      bucket_count_(other.GetBucketCount()),
+      capacity_(other.GetSize()),
+      size_(other.GetSize()) {
+  auto memory = AllocateTable(bucket_count_, capacity_, policy, numa_node);
+  buckets_ = static_cast<int64_t*>(memory->Data());
+  entries_ = reinterpret_cast<Entry*>(buckets_ + bucket_count_);
+  storage_ = std::move(memory);
+
+  std::copy(other.buckets_, other.buckets_ + bucket_count_, buckets_);
+  std::copy(other.entries_, other.entries_ + capacity_, entries_);
+}
+
+HashMap::HashMap(const int64_t* buckets, int64_t bucket_count,
+                 const Entry* entries, int64_t size,
+                 std::shared_ptr<void> storage)
+    : storage_(std::move(storage)),
+      is_read_only_(true),
+      // Map is full, so Insert never writes to the external memory
+      buckets_(const_cast<int64_t*>(buckets)),
+      bucket_count_(bucket_count),
+      entries_(const_cast<Entry*>(entries)),
+      capacity_(size),
+      size_(size) {}
+
+void HashMap::Insert(int64_t hash, int64_t code,
+                     std::chrono::nanoseconds* lock_wait) {
+  int64_t index = size_.fetch_add(1);
+  if (index >= capacity_) {
+    throw std::length_error("HashMap capacity exceeded");
+  }
+  entries_[index] = {hash, code, kNoEntry};
+
+  int64_t bucket_index = hash % bucket_count_;
   int64_t mutex_index = bucket_index % bucket_mutexes_.size();
 
-  std::lock_guard lock_guard(bucket_mutexes_[mutex_index]);
-  buckets_[bucket_index].push_back(value);
+  std::unique_lock unique_lock(bucket_mutexes_[mutex_index],
+                               std::try_to_lock);
+  if (!unique_lock.owns_lock()) {
+    // Clock is read only when the mutex is contended
+    auto start = std::chrono::steady_clock::now();
+    unique_lock.lock();
+    if (lock_wait != nullptr) {
+      *lock_wait += std::chrono::steady_clock::now() - start;
+    }
+  }
+  entries_[index].next = buckets_[bucket_index];
+  buckets_[bucket_index] = index;
 }
 
-std::string HashMap::Find(int64_t target_hash) {
-  int64_t index = target_hash % buckets_.size();
+int64_t HashMap::FindCode(int64_t target_hash) const {
+  int64_t index = buckets_[target_hash % bucket_count_];
 
-  for (const auto& value : buckets_[index]) {
-    if (value.GetHash() == target_hash) {
-      return value.Get();
+  for (; index != kNoEntry; index = entries_[index].next) {
+    if (entries_[index].hash == target_hash) {
+      return entries_[index].code;
     }
   }
-  return "";
+  return kNoEntry;
 }
 
 void HashMap::Clear() {
-  for (int index = 0; index < buckets_.size(); index++) {
+  if (is_read_only_) {
+    throw std::logic_error("Read-only HashMap can't be cleared");
+  }
+  for (int64_t index = 0; index < bucket_count_; index++) {
     int64_t mutex_index = index % bucket_mutexes_.size();
     std::lock_guard lock_guard(bucket_mutexes_[mutex_index]);
-    buckets_[index].clear();
+    buckets_[index] = kNoEntry;
+  }
+  size_.store(0);
+}
+
+const int64_t* HashMap::GetBuckets() const {
+  return buckets_;
+}
+
+int64_t HashMap::GetBucketCount() const {
+  return bucket_count_;
+}
+
+const HashMap::Entry* HashMap::GetEntries() const {
+  return entries_;
+}
+
+int64_t HashMap::GetSize() const {
+  return std::min(size_.load(), capacity_);
+}
+
+int64_t HashMap::GetMemoryUsage() const {
+  return bucket_count_ * sizeof(int64_t) + capacity_ * sizeof(Entry);
+}
+
+std::vector<int64_t> HashMap::GetBucketHistogram(int64_t max_length) const {
+  std::vector<int64_t> histogram(max_length + 1);
+  for (int64_t bucket = 0; bucket < bucket_count_; bucket++) {
+    int64_t length = 0;
+    for (int64_t index = buckets_[bucket]; index != kNoEntry;
+         index = entries_[index].next) {
+      length++;
+    }
+    histogram[std::min(length, max_length)]++;
   }
+  return histogram;
 }
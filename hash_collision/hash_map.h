@@ -1,26 +1,109 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "hash_string.h"
+#include "table_memory.h"
 
+// Chained hash map, stored in two flat arrays without pointers:
+// bucket heads and entries, linked by indices. It can be written to a file
+// as is and later used right from the mapped memory.
 class HashMap {
  public:
-  HashMap();
+  struct Entry {
+    int64_t hash;
+    // String, encoded with EncodeString of its alphabet.
+    int64_t code;
+    // Index of the next entry in the same bucket, or kNoEntry.
+    int64_t next;
+  };
 
-  void Insert(const HashString& value);
-  std::string Find(int64_t target_hash);
+  static constexpr int64_t kDefaultCapacity = 300'000;
+  static constexpr int64_t kNoEntry = -1;
+
+  // Memory is allocated according to the policy, numa_node is used
+  // for NumaMode::kReplicate.
+  explicit HashMap(int64_t capacity = kDefaultCapacity,
+                   const MemoryPolicy& policy = MemoryPolicy(),
+                   int numa_node = -1);
+
+  // Read-only copy of other map.
+  HashMap(const HashMap& other, const MemoryPolicy& policy, int numa_node);
+
+  // Read-only map over the arrays, which are kept alive by storage.
+  HashMap(const int64_t* buckets, int64_t bucket_count,
+          const Entry* entries, int64_t size, std::shared_ptr<void> storage);
+
+  // If lock_wait is given, time spent waiting for the bucket mutex
+  // is added to it.
+  template<typename Alphabet>
+  void Insert(const HashString<Alphabet>& value,
+              std::chrono::nanoseconds* lock_wait = nullptr);
+  // Hash is any non-negative key, code is the string from EncodeString.
+  void Insert(int64_t hash, int64_t code,
+              std::chrono::nanoseconds* lock_wait = nullptr);
+
+  template<typename Alphabet = LowercaseAlphabet>
+  std::string Find(int64_t target_hash) const;
+  // Returns kNoEntry, if there is no such hash.
+  int64_t FindCode(int64_t target_hash) const;
+  // Calls function(code) for every entry with this hash.
+  template<typename Function>
+  void ForEachCode(int64_t target_hash, Function function) const;
 
   void Clear();
 
+  const int64_t* GetBuckets() const;
+  int64_t GetBucketCount() const;
+  const Entry* GetEntries() const;
+  int64_t GetSize() const;
+  int64_t GetMemoryUsage() const;
+
+  // result[i] is the number of buckets with i entries, the last element
+  // counts all the longer buckets too.
+  std::vector<int64_t> GetBucketHistogram(int64_t max_length) const;
+
  private:
-  const int kBucketCount = 300'000;
   const int kMutexCount = 300;
 
  private:
-  std::vector<std::vector<HashString>> buckets_;
+  std::shared_ptr<void> storage_;
+  bool is_read_only_;
+
+  int64_t* buckets_;
+  int64_t bucket_count_;
+  Entry* entries_;
+  int64_t capacity_;
+  std::atomic<int64_t> size_;
+
   std::vector<std::mutex> bucket_mutexes_;
 };
+
+template<typename Alphabet>
+void HashMap::Insert(const HashString<Alphabet>& value,
+                     std::chrono::nanoseconds* lock_wait) {
+  Insert(value.GetHash(), value.GetCode(), lock_wait);
+}
+
+template<typename Alphabet>
+std::string HashMap::Find(int64_t target_hash) const {
+  int64_t code = FindCode(target_hash);
+  return code == kNoEntry ? "" : DecodeString<Alphabet>(code);
+}
+
+template<typename Function>
+void HashMap::ForEachCode(int64_t target_hash, Function function) const {
+  int64_t index = buckets_[target_hash % bucket_count_];
+
+  for (; index != kNoEntry; index = entries_[index].next) {
+    if (entries_[index].hash == target_hash) {
+      function(entries_[index].code);
+    }
+  }
+}
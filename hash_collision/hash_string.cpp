@@ -1,60 +1,113 @@
 #include "hash_string.h"
 
-HashString::HashString(int64_t power, int64_t module,
-                       int length, int64_t value_to_load)
-    : value_(length, 'a'),
-      power_(power),
-      module_(module),
-      hash_(Hash(value_, power, module)) {
+template<typename Alphabet>
+HashString<Alphabet>::HashString(int64_t power, int64_t module,
+                                 int length, int64_t value_to_load)
+    : power_(power),
+      module_(module) {
+  Reset(length);
   Load(value_to_load);
 }
 
-void HashString::Load(int64_t value) {
-  for (auto it = value_.rbegin(); it != value_.rend(); it++) {
-    *it = 'a' + value % kAlphabetSize;
-    value /= kAlphabetSize;
+template<typename Alphabet>
+void HashString<Alphabet>::Load(int64_t value) {
+  value_ = value;
+  hash_ = 0;
+  for (int index = digits_.size() - 1; index >= 0; index--) {
+    digits_[index] = char(value % Alphabet::kSize);
+    value /= Alphabet::kSize;
+    hash_ = (hash_ + __int128_t(digits_[index] + 1) *
+                     powers_[digits_.size() - 1 - index]) % module_;
   }
-  hash_ = Hash(value_, power_, module_);
 }
 
-void HashString::Load(const std::string& value) {
-  value_ = value;
-  hash_ = Hash(value_, power_, module_);
+template<typename Alphabet>
+void HashString<Alphabet>::Load(const std::string& value) {
+  Reset(value.size());
+  value_ = 0;
+  for (size_t index = 0; index < value.size(); index++) {
+    digits_[index] = char(Alphabet::ToDigit(value[index]));
+    value_ = value_ * Alphabet::kSize + digits_[index];
+  }
+  hash_ = Hash<Alphabet>(value, power_, module_);
 }
 
-std::string HashString::Get() const {
-  return value_;
+template<typename Alphabet>
+std::string HashString<Alphabet>::Get() const {
+  std::string result(digits_.size(), ' ');
+  for (size_t index = 0; index < digits_.size(); index++) {
+    result[index] = Alphabet::ToChar(digits_[index]);
+  }
+  return result;
 }
 
-int64_t HashString::GetHash() const {
+template<typename Alphabet>
+int64_t HashString<Alphabet>::GetHash() const {
   return hash_;
 }
 
-HashString& HashString::operator++() {
-  if (value_.empty()) {
+template<typename Alphabet>
+int64_t HashString<Alphabet>::GetCode() const {
+  return code_offset_ + value_;
+}
+
+template<typename Alphabet>
+HashString<Alphabet>& HashString<Alphabet>::operator++() {
+  if (digits_.empty()) {
     return *this;
   }
 
-  value_.back()++;
+  value_++;
+  digits_.back()++;
   hash_++;
   if (hash_ == module_) {
     hash_ = 0;
   }
 
-  if (value_.back() > 'z') {
+  if (digits_.back() == Alphabet::kSize) {
     RepairString();
   }
   return *this;
 }
 
-void HashString::RepairString() {
-  int index = value_.size();
+template<typename Alphabet>
+void HashString<Alphabet>::Reset(int length) {
+  digits_.assign(length, 0);
+
+  powers_.resize(length);
+  code_offset_ = 0;
+  for (int index = 0; index < length; index++) {
+    powers_[index] = index == 0
+        ? 1 % module_
+        : (__int128_t(powers_[index - 1]) * power_) % module_;
+    code_offset_ = code_offset_ * Alphabet::kSize + 1;
+  }
+}
+
+template<typename Alphabet>
+void HashString<Alphabet>::RepairString() {
+  // Every carry turns digit kSize into 0 and adds 1 to the previous digit,
+  // which changes hash by power^(i + 1) - kSize * power^i.
+  int index = digits_.size();
   while (--index > 0) {
-    if (value_[index] <= 'z') {
+    if (digits_[index] < Alphabet::kSize) {
       break;
     }
-    value_[index] = 'a';
-    value_[index - 1]++;
+    digits_[index] = 0;
+    digits_[index - 1]++;
+
+    int64_t position = digits_.size() - 1 - index;
+    int64_t delta = powers_[position + 1] -
+        (__int128_t(powers_[position]) * Alphabet::kSize) % module_;
+    hash_ = ((hash_ + delta) % module_ + module_) % module_;
+  }
+  // The first digit has overflowed, string wraps to all zero digits.
+  if (digits_[0] == Alphabet::kSize) {
+    Load(0);
   }
-  hash_ = Hash(value_, power_, module_);
 }
+
+template class HashString<LowercaseAlphabet>;
+template class HashString<BinaryAlphabet>;
+template class HashString<HexAlphabet>;
+template class HashString<PrintableAlphabet>;
@@ -1,9 +1,14 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include "../utilities.h"
 
+// String of fixed length over the Alphabet together with its hash.
+// Strings of one length are numbered in lexicographical order, and
+// operator++ moves to the next one, updating hash in amortized O(1).
+template<typename Alphabet = LowercaseAlphabet>
 class HashString {
  public:
   HashString(int64_t power, int64_t module, int length,
@@ -14,16 +19,32 @@ class HashString {
 
   std::string Get() const;
   int64_t GetHash() const;
+  // Same as EncodeString<Alphabet>(Get()), but without building the string.
+  int64_t GetCode() const;
 
   HashString& operator++();
 
  private:
+  void Reset(int length);
   void RepairString();
 
  private:
-  std::string value_;
+  // Digits of the characters, not the characters themselves.
+  std::string digits_;
 
   int64_t power_;
   int64_t module_;
-  int64_t hash_;
+  int64_t hash_ = 0;
+
+  // powers_[i] = power^i % module.
+  std::vector<int64_t> powers_;
+
+  int64_t value_ = 0;
+  // Code of the first string of this length.
+  int64_t code_offset_ = 0;
 };
+
+extern template class HashString<LowercaseAlphabet>;
+extern template class HashString<BinaryAlphabet>;
+extern template class HashString<HexAlphabet>;
+extern template class HashString<PrintableAlphabet>;
@@ -1,7 +1,19 @@
 #include "gtest.h"
 
+#include <set>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bloom_filter.h"
 #include "hash.h"
 #include "hash_map.h"
+#include "shard_protocol.h"
+#include "shard_worker.h"
+#include "table_file.h"
+#include "worker_team.h"
 
 const int64_t kPower = 31;
 const int64_t kModule09 = 1'000'000'007;
@@ -24,6 +36,283 @@ TEST(HashMap, Simple) {
   ASSERT_EQ("", hash_map.Find(Hash("hell")));
 }
 
+TEST(HashMap, Capacity) {
+  HashMap hash_map(1);
+  HashString s1(kPower, kModule09, 0);
+  s1.Load("hello");
+  hash_map.Insert(s1);
+  ASSERT_THROW(hash_map.Insert(s1), std::length_error);
+}
+
+TEST(BloomFilter, NoFalseNegatives) {
+  BloomFilter filter(10'000);
+  for (int64_t key = 0; key < 10'000; key++) {
+    filter.Insert(key * kPower);
+  }
+  for (int64_t key = 0; key < 10'000; key++) {
+    ASSERT_TRUE(filter.MayContain(key * kPower));
+  }
+}
+
+TEST(BloomFilter, FewFalsePositives) {
+  BloomFilter filter(10'000);
+  for (int64_t key = 0; key < 10'000; key++) {
+    filter.Insert(key);
+  }
+  int false_positives = 0;
+  for (int64_t key = 10'000; key < 20'000; key++) {
+    false_positives += filter.MayContain(key);
+  }
+  ASSERT_LT(false_positives, 500);
+}
+
+TEST(TableMemory, Policies) {
+  for (PageMode pages : {PageMode::kDefault, PageMode::kTransparentHuge,
+                         PageMode::kExplicitHuge}) {
+    for (NumaMode numa : {NumaMode::kDefault, NumaMode::kInterleave,
+                          NumaMode::kReplicate}) {
+      TableMemory memory(5 << 20, {pages, numa}, 0);
+      auto* data = static_cast<char*>(memory.Data());
+      ASSERT_EQ(0, data[0]);
+      ASSERT_EQ(0, data[memory.Size() - 1]);
+      data[memory.Size() - 1] = 1;
+    }
+  }
+}
+
+TEST(HashCollisionSearcher, MemoryPolicies) {
+  std::string target = "thisistest";
+  for (NumaMode numa : {NumaMode::kDefault, NumaMode::kInterleave,
+                        NumaMode::kReplicate}) {
+    HashCollisionSearcher searcher(kPower, kModule09);
+    searcher.SetMemoryPolicy({PageMode::kExplicitHuge, numa, true});
+    std::string result = searcher.FindCollision(target, 4, 2);
+    ASSERT_NE(target, result);
+    ASSERT_EQ(Hash(target), Hash(result));
+  }
+}
+
+TEST(EncodeString, DecodeString) {
+  for (const char* s : {"", "a", "z", "aa", "zz", "hello", "zzzzzzz"}) {
+    ASSERT_EQ(s, DecodeString(EncodeString(s)));
+  }
+  ASSERT_EQ(27, EncodeString("aa"));
+}
+
+TEST(TableFile, SaveAndLoad) {
+  std::string path = testing::TempDir() + "hash_table_test.bin";
+  HashMap hash_map(3);
+  for (const char* s : {"hello", "world", "abc"}) {
+    HashString string(kPower, kModule09, 0);
+    string.Load(s);
+    hash_map.Insert(string);
+  }
+  uint64_t alphabet = GetAlphabetId<LowercaseAlphabet>();
+  ASSERT_TRUE(SaveTable(path, {alphabet, kPower, kModule09, 5}, hash_map));
+
+  ASSERT_EQ(nullptr, LoadTable(path, {GetAlphabetId<HexAlphabet>(),
+                                      kPower, kModule09, 5}));
+  ASSERT_EQ(nullptr, LoadTable(path, {alphabet, kPower + 1, kModule09, 5}));
+  ASSERT_EQ(nullptr, LoadTable(path, {alphabet, kPower, kModule09 + 1, 5}));
+  ASSERT_EQ(nullptr, LoadTable(path, {alphabet, kPower, kModule09, 4}));
+  ASSERT_EQ(nullptr, LoadTable(path, {alphabet, kPower, kModule09, 5, 37,
+                                      10'007}));
+
+  auto loaded = LoadTable(path, {alphabet, kPower, kModule09, 5});
+  ASSERT_NE(nullptr, loaded);
+  ASSERT_EQ("hello", loaded->Find(Hash("hello")));
+  ASSERT_EQ("abc", loaded->Find(Hash("abc")));
+  ASSERT_EQ("", loaded->Find(Hash("hell")));
+
+  // Multiplied by the bucket size, the count wraps around to the real one.
+  TableFileHeader header{};
+  FILE* file = std::fopen(path.c_str(), "r+b");
+  ASSERT_EQ(1u, std::fread(&header, sizeof(header), 1, file));
+  header.bucket_count += int64_t(1) << 61;
+  std::fseek(file, 0, SEEK_SET);
+  std::fwrite(&header, sizeof(header), 1, file);
+  std::fclose(file);
+  ASSERT_EQ(nullptr, LoadTable(path, {alphabet, kPower, kModule09, 5}));
+
+  ASSERT_TRUE(SaveTable(path, {alphabet, kPower, kModule09, 5}, hash_map));
+  file = std::fopen(path.c_str(), "r+b");
+  std::fseek(file, -1, SEEK_END);
+  std::fputc('x', file);
+  std::fclose(file);
+  ASSERT_EQ(nullptr, LoadTable(path, {alphabet, kPower, kModule09, 5}));
+  std::remove(path.c_str());
+}
+
+TEST(HashCollisionSearcher, TablesDirectory) {
+  std::string directory = testing::TempDir();
+  std::string path = directory + "/table_lowercase_31_1000000007_4.bin";
+  std::string target = "thisistest";
+
+  HashCollisionSearcher builder(kPower, kModule09);
+  builder.SetTablesDirectory(directory);
+  builder.FindCollision(target, 4, 2);
+
+  // Threads race for the first collision, so only single-threaded
+  // searches are compared.
+  HashCollisionSearcher loader(kPower, kModule09);
+  ASSERT_TRUE(loader.LoadTable(4, path));
+  ASSERT_EQ(builder.FindCollision(target, 4, 1),
+            loader.FindCollision(target, 4, 1));
+  std::remove(path.c_str());
+}
+
+TEST(HashCollisionSearcher, WithoutPrefilter) {
+  std::string target = "thisistest";
+  HashCollisionSearcher with_filter(kPower, kModule09);
+  HashCollisionSearcher without_filter(kPower, kModule09);
+  without_filter.SetPrefilterEnabled(false);
+  ASSERT_EQ(with_filter.FindCollision(target, 4, 1),
+            without_filter.FindCollision(target, 4, 1));
+}
+
+TEST(HashCollisionSearcher, FindAllCollisions) {
+  std::string target = "thisistest";
+  HashCollisionSearcher searcher(kPower, 1'000'003);
+
+  std::set<std::string> found;
+  int64_t count = searcher.FindAllCollisions(
+      target, 3, 100, 4, [&found, &target](const auto& collision) {
+        ASSERT_EQ(Hash(target, kPower, 1'000'003),
+                  Hash(collision.value, kPower, 1'000'003));
+        ASSERT_NE(target, collision.value);
+        found.insert(collision.value);
+      });
+  ASSERT_EQ(100, count);
+  ASSERT_EQ(100u, found.size());
+}
+
+TEST(HashCollisionSearcher, FindAllCollisionsExhausted) {
+  std::string target = "thisistest";
+  HashCollisionSearcher searcher(kPower, kModule09);
+
+  int64_t calls = 0;
+  int64_t count = searcher.FindAllCollisions(
+      target, 1, 100, 2, [&calls](const auto&) { calls++; });
+  ASSERT_EQ(calls, count);
+  ASSERT_GT(100, count);
+}
+
+TEST(HashCollisionSearcher, Stats) {
+  SearchStats stats;
+  HashCollisionSearcher searcher(kPower, kModule09);
+  searcher.SetStats(&stats);
+  searcher.FindCollision("thisistest", 4, 2);
+
+  const LengthStats& length_stats = stats.GetLength(4);
+  ASSERT_EQ(26 * 26 * 26 * 26, length_stats.table.entries);
+  ASSERT_LT(0, length_stats.table.bytes);
+
+  int64_t buckets = 0;
+  for (int64_t count : length_stats.table.bucket_histogram) {
+    buckets += count;
+  }
+  ASSERT_EQ(HashMap(26 * 26 * 26 * 26).GetBucketCount(), buckets);
+
+  int64_t built = 0;
+  for (const auto& thread_stats : length_stats.build_threads) {
+    built += thread_stats.strings;
+  }
+  ASSERT_EQ(26 * 26 * 26 * 26, built);
+  ASSERT_FALSE(length_stats.probe_threads.empty());
+  ASSERT_LT(0, length_stats.probe_threads[0].strings);
+}
+
+TEST(FindManyCollisions, Distinct) {
+  std::string target = "abacaba";
+  auto results = FindManyCollisions(target, kPower, kModule09, 50, 6, 2);
+  ASSERT_EQ(50u, results.size());
+  ASSERT_EQ(50u, std::set<std::string>(results.begin(), results.end()).size());
+  for (const auto& result : results) {
+    ASSERT_NE(target, result);
+    ASSERT_EQ(Hash(target), Hash(result));
+  }
+}
+
+TEST(HashCollisionSearcher, EstimateStringLength) {
+  ASSERT_EQ(0, HashCollisionSearcher(kPower, 1).EstimateStringLength());
+  ASSERT_EQ(3, HashCollisionSearcher(kPower, kModule09).EstimateStringLength());
+  ASSERT_EQ(5, HashCollisionSearcher(kPower, 10'000'000'000'019)
+      .EstimateStringLength());
+}
+
+TEST(HashCollisionSearcher, TablesReused) {
+  HashCollisionSearcher searcher(kPower, kModule09);
+  SearchStats stats;
+  searcher.SetStats(&stats);
+  auto get_built_strings = [&stats](int64_t length) {
+    int64_t strings = 0;
+    for (const auto& thread_stats : stats.GetLength(length).build_threads) {
+      strings += thread_stats.strings;
+    }
+    return strings;
+  };
+
+  std::string target = "abacaba";
+  for (int64_t length : {1, 2, 3, 4, 4, 3}) {
+    std::string result = searcher.FindCollision(target, length, 2);
+    if (!result.empty()) {
+      ASSERT_NE(target, result);
+      ASSERT_EQ(Hash(target), Hash(result));
+    }
+  }
+  // Repeated length and the previous one keep their tables, so every
+  // table has been built once.
+  for (int64_t length = 1; length <= 4; length++) {
+    ASSERT_EQ(BinaryPow(26, length), get_built_strings(length));
+  }
+
+  // Shorter tables were freed and are built again.
+  searcher.FindCollision(target, 1, 2);
+  ASSERT_EQ(2 * 26, get_built_strings(1));
+}
+
+TEST(WorkerTeam, PhasesReuseThreads) {
+  const int kThreadCount = 4;
+  WorkerTeam team(kThreadCount, false);
+  ASSERT_EQ(kThreadCount, team.GetThreadCount());
+
+  std::vector<std::thread::id> first_ids(kThreadCount);
+  team.Run([&](int thread_index) {
+    first_ids[thread_index] = std::this_thread::get_id();
+  });
+  std::set<std::thread::id> distinct_ids(first_ids.begin(), first_ids.end());
+  ASSERT_EQ(kThreadCount, int(distinct_ids.size()));
+
+  // Each phase sees the writes of the previous one and runs every part
+  // in the same thread.
+  std::vector<int> values[2] = {std::vector<int>(kThreadCount, -1),
+                                std::vector<int>(kThreadCount)};
+  std::atomic<int> mismatch_count(0);
+  for (int phase = 0; phase < 1000; phase++) {
+    const auto& previous = values[phase % 2];
+    auto& current = values[(phase + 1) % 2];
+    team.Run([&, phase](int thread_index) {
+      if (first_ids[thread_index] != std::this_thread::get_id() ||
+          previous[(thread_index + 1) % kThreadCount] != phase - 1) {
+        mismatch_count.fetch_add(1);
+      }
+      current[thread_index] = phase;
+    });
+  }
+  ASSERT_EQ(0, mismatch_count.load());
+}
+
+TEST(HashCollisionSearcher, ConcurrencyChanges) {
+  // Team is recreated, once the number of threads differs.
+  HashCollisionSearcher searcher(kPower, kModule09);
+  std::string target = "abacaba";
+  for (uint8_t concurrency : {1, 4, 2, 2}) {
+    std::string result = searcher.FindCollision(target, 4, concurrency);
+    ASSERT_NE(target, result);
+    ASSERT_EQ(Hash(target), Hash(result));
+  }
+}
+
 void Check(const std::string& s, uint8_t concurrency,
            int64_t power = kPower, int64_t module = kModule09) {
   std::string result = FindCollision(s, power, module, concurrency);
@@ -84,3 +373,217 @@ TEST(FindCollision, BigModuleMultiThread) {
 
   Check(target, 4, power, module);
 }
+
+void CheckBatch(const std::vector<std::string>& targets, uint8_t concurrency,
+                int64_t power = kPower, int64_t module = kModule09) {
+  auto results = FindCollisions(targets, power, module, concurrency);
+  ASSERT_EQ(targets.size(), results.size());
+  for (size_t index = 0; index < targets.size(); index++) {
+    ASSERT_NE(targets[index], results[index]);
+    ASSERT_EQ(Hash(targets[index], power, module),
+              Hash(results[index], power, module));
+  }
+}
+
+TEST(FindCollisions, Empty) {
+  ASSERT_TRUE(FindCollisions({}, kPower, kModule09, 4).empty());
+}
+
+TEST(FindCollisions, FewerTargetsThanThreads) {
+  CheckBatch({"hello", "world"}, 4);
+}
+
+TEST(FindCollisions, ManyTargets) {
+  static std::random_device random_device;
+  static std::mt19937_64 generator(random_device());
+
+  std::vector<std::string> targets(100, std::string(20, 'a'));
+  for (auto& target : targets) {
+    RandomizeString(&generator, &target);
+  }
+
+  CheckBatch(targets, 1);
+  CheckBatch(targets, 4);
+}
+
+void CheckDouble(const std::string& s, uint8_t concurrency,
+                 HashParameters first, HashParameters second) {
+  std::string result = FindDoubleCollision(s, first, second, concurrency);
+  ASSERT_NE(s, result);
+  ASSERT_EQ(Hash(s, first.power, first.module),
+            Hash(result, first.power, first.module));
+  ASSERT_EQ(Hash(s, second.power, second.module),
+            Hash(result, second.power, second.module));
+}
+
+TEST(DoubleHasher, BothHashes) {
+  DoubleHasher<LowercaseAlphabet> hasher({kPower, kModule09},
+                                         {37, 998'244'353});
+  auto string = hasher.MakeString(3);
+  for (int index = 0; index < 1000; index++, ++string) {
+    int64_t key = Hash(string.Get(), kPower, kModule09) * 998'244'353 +
+                  Hash(string.Get(), 37, 998'244'353);
+    ASSERT_EQ(key, hasher.GetKey(string));
+    ASSERT_EQ(key, hasher.GetKey(string.Get()));
+  }
+}
+
+TEST(FindDoubleCollision, Simple) {
+  CheckDouble("thisistest", 1, {kPower, 100'003}, {37, 100'019});
+  CheckDouble("thisistest", 4, {kPower, 100'003}, {37, 100'019});
+}
+
+TEST(FindDoubleCollision, ShortStrings) {
+  std::string target;
+  for (int i = 0; i <= 5; i++, target += 'a') {
+    CheckDouble(target, 2, {kPower, 10'007}, {kPower, 10'009});
+  }
+}
+
+TEST(FindDoubleCollision, Alphabet) {
+  std::string target = "0123456789abcdef";
+  HashParameters first{kPower, 100'003};
+  HashParameters second{37, 100'019};
+  std::string result =
+      FindDoubleCollision<HexAlphabet>(target, first, second, 2);
+  ASSERT_NE(target, result);
+  ASSERT_EQ(Hash<HexAlphabet>(target, first.power, first.module),
+            Hash<HexAlphabet>(result, first.power, first.module));
+  ASSERT_EQ(Hash<HexAlphabet>(target, second.power, second.module),
+            Hash<HexAlphabet>(result, second.power, second.module));
+}
+
+template<typename Alphabet>
+void CheckHashString(int length) {
+  HashString<Alphabet> string(kPower, kModule09, length);
+  int64_t count = BinaryPow(Alphabet::kSize, length);
+  for (int64_t value = 0; value < count; value++, ++string) {
+    ASSERT_EQ(Hash<Alphabet>(string.Get(), kPower, kModule09),
+              string.GetHash());
+    ASSERT_EQ(EncodeString<Alphabet>(string.Get()), string.GetCode());
+    ASSERT_EQ(string.Get(),
+              DecodeString<Alphabet>(EncodeString<Alphabet>(string.Get())));
+  }
+}
+
+TEST(HashString, Alphabets) {
+  CheckHashString<LowercaseAlphabet>(3);
+  CheckHashString<BinaryAlphabet>(10);
+  CheckHashString<HexAlphabet>(4);
+  CheckHashString<PrintableAlphabet>(2);
+}
+
+template<typename Alphabet>
+void CheckAlphabet(int length, uint8_t concurrency) {
+  static std::mt19937_64 generator(42);
+
+  std::string target(length, ' ');
+  RandomizeString<Alphabet>(&generator, &target);
+
+  std::string result =
+      FindCollision<Alphabet>(target, kPower, kModule09, concurrency);
+  ASSERT_NE(target, result);
+  ASSERT_EQ(Hash<Alphabet>(target, kPower, kModule09),
+            Hash<Alphabet>(result, kPower, kModule09));
+  for (char ch : result) {
+    ASSERT_LE(0, Alphabet::ToDigit(ch));
+    ASSERT_GT(Alphabet::kSize, Alphabet::ToDigit(ch));
+  }
+}
+
+TEST(FindCollision, Alphabets) {
+  CheckAlphabet<BinaryAlphabet>(50, 1);
+  CheckAlphabet<BinaryAlphabet>(50, 4);
+  CheckAlphabet<HexAlphabet>(20, 2);
+  CheckAlphabet<PrintableAlphabet>(20, 2);
+}
+
+TEST(ShardWorker, KeepsPreviousTable) {
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  std::thread worker([fd = fds[1]] {
+    ShardWorker(2).Serve(fd);
+    close(fd);
+  });
+
+  ShardMessage type;
+  std::vector<int64_t> payload;
+  for (int64_t length : {2, 3}) {
+    ASSERT_TRUE(SendMessage(fds[0], ShardMessage::kBuild,
+                            {int64_t(GetAlphabetId<LowercaseAlphabet>()),
+                             kPower, kModule09, length, 0, 1}));
+    ASSERT_TRUE(ReceiveMessage(fds[0], &type, &payload));
+    ASSERT_EQ(ShardMessage::kReady, type);
+    ASSERT_EQ(std::vector<int64_t>{BinaryPow(26, length)}, payload);
+  }
+
+  ASSERT_TRUE(SendMessage(fds[0], ShardMessage::kProbe,
+                          {2, Hash("ab"), 3, Hash("abc"), 3, Hash("ab")}));
+  ASSERT_TRUE(ReceiveMessage(fds[0], &type, &payload));
+  ASSERT_EQ(ShardMessage::kProbeResult, type);
+  std::vector<int64_t> expected = {0, EncodeString("ab"), 1,
+                                   EncodeString("abc")};
+  ASSERT_EQ(expected, payload);
+
+  ASSERT_TRUE(SendMessage(fds[0], ShardMessage::kShutdown));
+  worker.join();
+  close(fds[0]);
+}
+
+TEST(FindShardedCollision, Threads) {
+  std::string target = "thisistest";
+  std::vector<int> shard_fds;
+  std::vector<std::thread> workers;
+  for (int shard = 0; shard < 3; shard++) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    shard_fds.push_back(fds[0]);
+    workers.emplace_back([fd = fds[1]] {
+      ShardWorker().Serve(fd);
+      close(fd);
+    });
+  }
+
+  std::string result = FindShardedCollision(target, kPower, kModule09,
+                                            shard_fds);
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  ASSERT_NE(target, result);
+  ASSERT_EQ(Hash(target), Hash(result));
+}
+
+TEST(FindShardedCollision, Processes) {
+  std::string target = "abacaba";
+  std::vector<int> shard_fds;
+  std::vector<pid_t> workers;
+  for (int shard = 0; shard < 2; shard++) {
+    std::string path =
+        testing::TempDir() + "/hash_shard_" + std::to_string(shard);
+    int listen_fd = ListenUnixSocket(path);
+    ASSERT_NE(-1, listen_fd);
+
+    pid_t pid = fork();
+    ASSERT_NE(-1, pid);
+    if (pid == 0) {
+      int fd = AcceptConnection(listen_fd);
+      _exit(fd != -1 && ShardWorker().Serve(fd) ? 0 : 1);
+    }
+    workers.push_back(pid);
+    shard_fds.push_back(ConnectUnixSocket(path));
+    close(listen_fd);
+    unlink(path.c_str());
+    ASSERT_NE(-1, shard_fds.back());
+  }
+
+  std::string result = FindShardedCollision(target, kPower, kModule09,
+                                            shard_fds);
+  ASSERT_NE(target, result);
+  ASSERT_EQ(Hash(target), Hash(result));
+  for (pid_t pid : workers) {
+    int status;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(0, WEXITSTATUS(status));
+  }
+}
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "hash_string.h"
+#include "table_file.h"
+#include "../utilities.h"
+
+struct HashParameters {
+  int64_t power;
+  int64_t module;
+};
+
+// Prefixes and suffixes of length L give about Alphabet::kSize^(2L) pairs,
+// so lengths with Alphabet::kSize^(2L + 1) < key_count almost never collide
+// and are not worth building tables for.
+template<typename Alphabet>
+int64_t EstimateStringLength(__int128_t key_count) {
+  int64_t length = 0;
+  __int128_t pairs_count = Alphabet::kSize;
+  while (pairs_count < key_count) {
+    pairs_count *= Alphabet::kSize * Alphabet::kSize;
+    length++;
+  }
+  return length;
+}
+
+// Hashers map strings to keys of the suffix tables: a prefix and a suffix
+// collide with the target, when the key of the suffix is the one, which
+// GetSuffixKey gives for the prefix. Strings of a length are enumerated
+// by Hasher::String, which keeps the key up to date on operator++.
+
+// Polynomial hash of Hash<Alphabet>, the key is the hash itself.
+template<typename Alphabet>
+class PolynomialHasher {
+ public:
+  using String = HashString<Alphabet>;
+  // power^length, moves hash of a prefix before the suffix.
+  using Shift = int64_t;
+
+  PolynomialHasher(int64_t power, int64_t module)
+      : parameters_{power, module} {
+  }
+
+  const HashParameters& GetParameters() const {
+    return parameters_;
+  }
+
+  // Keys are in [0; GetKeyCount()).
+  int64_t GetKeyCount() const {
+    return parameters_.module;
+  }
+
+  int64_t GetKey(const std::string& value) const {
+    return Hash<Alphabet>(value, parameters_.power, parameters_.module);
+  }
+
+  int64_t GetKey(const String& string) const {
+    return string.GetHash();
+  }
+
+  String MakeString(int length, int64_t value_to_load = 0) const {
+    return String(parameters_.power, parameters_.module, length,
+                  value_to_load);
+  }
+
+  Shift GetShift(int64_t length) const {
+    return BinaryPow(parameters_.power, length, parameters_.module);
+  }
+
+  int64_t GetSuffixKey(const String& prefix, Shift shift,
+                       int64_t target_key) const {
+    int64_t module = parameters_.module;
+    int64_t shifted_hash = (__int128_t(prefix.GetHash()) * shift) % module;
+    return (target_key - shifted_hash + module) % module;
+  }
+
+  TableParameters GetTableParameters(int64_t length) const {
+    return {GetAlphabetId<Alphabet>(), parameters_.power, parameters_.module,
+            length};
+  }
+
+  // Distinguishes table files of different hashes.
+  std::string GetName() const {
+    return std::to_string(parameters_.power) + "_" +
+           std::to_string(parameters_.module);
+  }
+
+ private:
+  HashParameters parameters_;
+};
+
+// Two polynomial hashes at once. Key is first_hash * second.module +
+// second_hash, so keys are equal only for a collision under both of them.
+template<typename Alphabet>
+class DoubleHasher {
+ public:
+  // Both strings go over the same characters, each keeps its own hash.
+  struct String {
+    HashString<Alphabet> first;
+    HashString<Alphabet> second;
+
+    std::string Get() const {
+      return first.Get();
+    }
+
+    int64_t GetCode() const {
+      return first.GetCode();
+    }
+
+    String& operator++() {
+      ++first;
+      ++second;
+      return *this;
+    }
+  };
+
+  using Shift = std::pair<int64_t, int64_t>;
+
+  // Product of modules must fit into int64_t.
+  DoubleHasher(HashParameters first, HashParameters second)
+      : first_(first.power, first.module),
+        second_(second.power, second.module) {
+    if (__int128_t(first.module) * second.module > INT64_MAX) {
+      throw std::invalid_argument(
+          "Product of modules doesn't fit into int64_t");
+    }
+  }
+
+  int64_t GetKeyCount() const {
+    return first_.GetKeyCount() * second_.GetKeyCount();
+  }
+
+  int64_t GetKey(const std::string& value) const {
+    return first_.GetKey(value) * second_.GetKeyCount() +
+           second_.GetKey(value);
+  }
+
+  int64_t GetKey(const String& string) const {
+    return first_.GetKey(string.first) * second_.GetKeyCount() +
+           second_.GetKey(string.second);
+  }
+
+  String MakeString(int length, int64_t value_to_load = 0) const {
+    return {first_.MakeString(length, value_to_load),
+            second_.MakeString(length, value_to_load)};
+  }
+
+  Shift GetShift(int64_t length) const {
+    return {first_.GetShift(length), second_.GetShift(length)};
+  }
+
+  int64_t GetSuffixKey(const String& prefix, const Shift& shift,
+                       int64_t target_key) const {
+    int64_t second_module = second_.GetKeyCount();
+    return first_.GetSuffixKey(prefix.first, shift.first,
+                               target_key / second_module) * second_module +
+           second_.GetSuffixKey(prefix.second, shift.second,
+                                target_key % second_module);
+  }
+
+  TableParameters GetTableParameters(int64_t length) const {
+    TableParameters parameters = first_.GetTableParameters(length);
+    parameters.second_power = second_.GetParameters().power;
+    parameters.second_module = second_.GetParameters().module;
+    return parameters;
+  }
+
+  std::string GetName() const {
+    return first_.GetName() + "_" + second_.GetName();
+  }
+
+ private:
+  PolynomialHasher<Alphabet> first_;
+  PolynomialHasher<Alphabet> second_;
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+struct ThreadStats {
+  // Strings inserted into the table or checked as prefixes.
+  int64_t strings = 0;
+  double seconds = 0;
+  // Time spent waiting for the striped mutexes of HashMap.
+  double lock_wait_seconds = 0;
+};
+
+struct TableStats {
+  int64_t entries = 0;
+  int64_t bytes = 0;
+  int64_t filter_bytes = 0;
+  // bucket_histogram[i] is the number of buckets with i entries,
+  // the last element counts all the longer buckets too.
+  std::vector<int64_t> bucket_histogram;
+};
+
+// Times are summed over all searches with this length.
+struct LengthStats {
+  int64_t length = 0;
+
+  double build_seconds = 0;
+  double load_seconds = 0;
+  double probe_seconds = 0;
+
+  TableStats table;
+  std::vector<ThreadStats> build_threads;
+  std::vector<ThreadStats> probe_threads;
+};
+
+struct SearchStats {
+  std::vector<LengthStats> lengths;
+
+  LengthStats& GetLength(int64_t length) {
+    for (auto& length_stats : lengths) {
+      if (length_stats.length == length) {
+        return length_stats;
+      }
+    }
+    lengths.emplace_back();
+    lengths.back().length = length;
+    return lengths.back();
+  }
+};
@@ -0,0 +1,143 @@
+#include "shard_protocol.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <endian.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+// Batches are limited by the coordinator, so anything larger is garbage.
+const int64_t kMaxPayloadSize = 1 << 24;
+
+bool WriteAll(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+bool ReadAll(int fd, char* data, size_t size) {
+  while (size > 0) {
+    ssize_t read = recv(fd, data, size, 0);
+    if (read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (read <= 0) {
+      return false;
+    }
+    data += read;
+    size -= read;
+  }
+  return true;
+}
+
+bool MakeAddress(const std::string& path, sockaddr_un* address) {
+  if (path.size() >= sizeof(address->sun_path)) {
+    return false;
+  }
+  std::memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  std::memcpy(address->sun_path, path.c_str(), path.size());
+  return true;
+}
+
+}  // namespace
+
+bool SendMessage(int fd, ShardMessage type,
+                 const std::vector<int64_t>& payload) {
+  std::vector<uint64_t> words;
+  words.reserve(payload.size() + 2);
+  words.push_back(htole64(static_cast<uint64_t>(type)));
+  words.push_back(htole64(payload.size()));
+  for (int64_t value : payload) {
+    words.push_back(htole64(static_cast<uint64_t>(value)));
+  }
+  return WriteAll(fd, reinterpret_cast<const char*>(words.data()),
+                  words.size() * sizeof(uint64_t));
+}
+
+bool ReceiveMessage(int fd, ShardMessage* type,
+                    std::vector<int64_t>* payload) {
+  uint64_t header[2];
+  if (!ReadAll(fd, reinterpret_cast<char*>(header), sizeof(header))) {
+    return false;
+  }
+  int64_t size = le64toh(header[1]);
+  if (size < 0 || size > kMaxPayloadSize) {
+    return false;
+  }
+
+  payload->resize(size);
+  if (!ReadAll(fd, reinterpret_cast<char*>(payload->data()),
+               size * sizeof(int64_t))) {
+    return false;
+  }
+  for (auto& value : *payload) {
+    value = le64toh(value);
+  }
+  *type = static_cast<ShardMessage>(le64toh(header[0]));
+  return true;
+}
+
+bool HasPendingMessage(int fd) {
+  pollfd poll_fd{fd, POLLIN, 0};
+  return poll(&poll_fd, 1, 0) > 0;
+}
+
+int ListenUnixSocket(const std::string& path) {
+  sockaddr_un address;
+  if (!MakeAddress(path, &address)) {
+    return -1;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  unlink(path.c_str());
+  if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+      listen(fd, 1) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int AcceptConnection(int listen_fd) {
+  int fd;
+  do {
+    fd = accept(listen_fd, nullptr, nullptr);
+  } while (fd < 0 && errno == EINTR);
+  return fd;
+}
+
+int ConnectUnixSocket(const std::string& path) {
+  sockaddr_un address;
+  if (!MakeAddress(path, &address)) {
+    return -1;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (connect(fd, reinterpret_cast<sockaddr*>(&address),
+              sizeof(address)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Messages between ShardedCollisionSearcher and ShardWorker. Every message
+// is its type, payload length and payload, all written as little-endian
+// int64_t, so the protocol works over any stream socket, whatever the
+// byte order of the hosts is.
+enum class ShardMessage : int64_t {
+  // Coordinator -> worker.
+  // {alphabet id, power, module, length, shard index, shard count}
+  // Table of length - 1 is kept, if the shard has built it before.
+  kBuild = 1,
+  // {suffix length, suffix hash} for every suffix, which is needed by
+  // a batch of prefixes.
+  kProbe = 2,
+  // Stops the current batch, if any. Always answered with kCancelled.
+  kCancel = 3,
+  kShutdown = 4,
+
+  // Worker -> coordinator.
+  // {number of suffixes of this length in the shard}
+  kReady = 5,
+  // {position of the pair in batch, suffix code} for every hit of the batch.
+  kProbeResult = 6,
+  kCancelled = 7,
+  kError = 8,
+};
+
+bool SendMessage(int fd, ShardMessage type,
+                 const std::vector<int64_t>& payload = {});
+// Returns false on closed connection, I/O error or malformed message.
+bool ReceiveMessage(int fd, ShardMessage* type, std::vector<int64_t>* payload);
+
+// Returns true if a message can be read from fd without blocking.
+bool HasPendingMessage(int fd);
+
+// Helpers for shards, which run as separate processes on one machine.
+// All of them return -1 on error.
+int ListenUnixSocket(const std::string& path);
+int AcceptConnection(int listen_fd);
+int ConnectUnixSocket(const std::string& path);
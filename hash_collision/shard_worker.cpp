@@ -0,0 +1,164 @@
+#include "shard_worker.h"
+
+#include <algorithm>
+#include <thread>
+#include <utility>
+
+#include "hash_string.h"
+#include "shard_protocol.h"
+
+namespace {
+
+int GetThreadCount(int thread_count) {
+  if (thread_count > 0) {
+    return thread_count;
+  }
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+}  // namespace
+
+ShardWorker::ShardWorker(int thread_count)
+    : team_(GetThreadCount(thread_count), false) {}
+
+bool ShardWorker::Serve(int fd) {
+  ShardMessage type;
+  std::vector<int64_t> payload;
+  while (ReceiveMessage(fd, &type, &payload)) {
+    switch (type) {
+      case ShardMessage::kBuild:
+        if (!Build(fd, payload)) {
+          return false;
+        }
+        break;
+      case ShardMessage::kProbe:
+        if (!Probe(fd, payload)) {
+          return false;
+        }
+        break;
+      case ShardMessage::kCancel:
+        // Batch was already answered, but coordinator waits for this reply.
+        if (!SendMessage(fd, ShardMessage::kCancelled)) {
+          return false;
+        }
+        break;
+      case ShardMessage::kShutdown:
+        return true;
+      default:
+        SendMessage(fd, ShardMessage::kError);
+        return false;
+    }
+  }
+  return false;
+}
+
+bool ShardWorker::Build(int fd, const std::vector<int64_t>& payload) {
+  if (payload.size() != 6 ||
+      static_cast<uint64_t>(payload[0]) != GetAlphabetId<LowercaseAlphabet>() ||
+      payload[3] < 1 || payload[4] < 0 || payload[4] >= payload[5]) {
+    SendMessage(fd, ShardMessage::kError);
+    return false;
+  }
+
+  // Parameters of all the kept tables are the same except for the length.
+  int64_t length = payload[3];
+  TableParameters parameters{static_cast<uint64_t>(payload[0]), payload[1],
+                             payload[2], 0};
+  if (parameters.power != parameters_.power ||
+      parameters.module != parameters_.module ||
+      shard_index_ != payload[4] || shard_count_ != payload[5]) {
+    tables_.clear();
+    parameters_ = parameters;
+    shard_index_ = payload[4];
+    shard_count_ = payload[5];
+  }
+
+  tables_.erase(tables_.begin(),
+                tables_.lower_bound(length - kKeptTableCount + 1));
+  tables_.erase(tables_.upper_bound(length), tables_.end());
+  if (tables_.count(length) == 0) {
+    BuildTable(length);
+  }
+
+  return SendMessage(fd, ShardMessage::kReady,
+                     {tables_.at(length).hash_map->GetSize()});
+}
+
+void ShardWorker::BuildTable(int64_t length) {
+  // Strings are enumerated once: threads keep the suffixes of this shard,
+  // so the table is allocated with the exact size, and then insert them.
+  int64_t max_value = BinaryPow(kAlphabetSize, length) - 1;
+  auto segments =
+      SplitIntoSegments(0, max_value, std::min(team_.GetThreadCount(), 255));
+  std::vector<std::vector<std::pair<int64_t, int64_t>>> suffixes(
+      segments.size());
+
+  team_.Run([&](int thread_index) {
+    if (thread_index >= int(segments.size())) {
+      return;
+    }
+    auto [from, to] = segments[thread_index];
+    HashString string(parameters_.power, parameters_.module, length, from);
+    for (; from <= to; ++from, ++string) {
+      if (string.GetHash() % shard_count_ == shard_index_) {
+        suffixes[thread_index].emplace_back(string.GetHash(),
+                                            string.GetCode());
+      }
+    }
+  });
+
+  int64_t size = 0;
+  for (const auto& thread_suffixes : suffixes) {
+    size += thread_suffixes.size();
+  }
+  ShardTable& table = tables_[length];
+  table.hash_map = std::make_unique<HashMap>(size);
+  table.filter = std::make_unique<BloomFilter>(size);
+
+  team_.Run([&](int thread_index) {
+    if (thread_index >= int(segments.size())) {
+      return;
+    }
+    for (const auto& [hash, code] : suffixes[thread_index]) {
+      table.hash_map->Insert(hash, code);
+      table.filter->Insert(hash);
+    }
+    suffixes[thread_index] = {};
+  });
+}
+
+bool ShardWorker::Probe(int fd, const std::vector<int64_t>& payload) {
+  if (tables_.empty() || payload.size() % 2 != 0) {
+    SendMessage(fd, ShardMessage::kError);
+    return false;
+  }
+
+  std::vector<int64_t> hits;
+  for (size_t index = 0; index < payload.size() / 2; index++) {
+    if (index % kCancelCheckInterval == 0 && HasPendingMessage(fd)) {
+      ShardMessage type;
+      std::vector<int64_t> message;
+      if (!ReceiveMessage(fd, &type, &message) ||
+          type != ShardMessage::kCancel) {
+        return false;
+      }
+      return SendMessage(fd, ShardMessage::kCancelled);
+    }
+
+    auto it = tables_.find(payload[2 * index]);
+    int64_t hash = payload[2 * index + 1];
+    if (it == tables_.end()) {
+      SendMessage(fd, ShardMessage::kError);
+      return false;
+    }
+    if (!it->second.filter->MayContain(hash)) {
+      continue;
+    }
+    int64_t code = it->second.hash_map->FindCode(hash);
+    if (code != HashMap::kNoEntry) {
+      hits.push_back(index);
+      hits.push_back(code);
+    }
+  }
+  return SendMessage(fd, ShardMessage::kProbeResult, hits);
+}
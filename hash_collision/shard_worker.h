@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "bloom_filter.h"
+#include "hash_map.h"
+#include "table_file.h"
+#include "worker_team.h"
+
+// Holds one shard of the suffix tables: suffixes, whose hash modulo shard
+// count equals shard index, so shards of one table together need as much
+// memory as the table, but can live in different processes. Like
+// HashCollisionSearcher, it keeps the tables of the last two lengths.
+// Only LowercaseAlphabet is supported.
+class ShardWorker {
+ public:
+  // Tables are built by thread_count threads, zero means one per core.
+  explicit ShardWorker(int thread_count = 0);
+
+  // Answers messages from fd until kShutdown or closed connection.
+  // Returns false if connection was broken or protocol violated.
+  bool Serve(int fd);
+
+ private:
+  // Cancellation is checked once per this many probes.
+  static const int64_t kCancelCheckInterval = 1024;
+  // Same as HashCollisionSearcher::kKeptTableCount.
+  static const int64_t kKeptTableCount = 2;
+
+  struct ShardTable {
+    std::unique_ptr<HashMap> hash_map;
+    std::unique_ptr<BloomFilter> filter;
+  };
+
+ private:
+  bool Build(int fd, const std::vector<int64_t>& payload);
+  void BuildTable(int64_t length);
+  bool Probe(int fd, const std::vector<int64_t>& payload);
+
+ private:
+  TableParameters parameters_{};
+  int64_t shard_index_ = 0;
+  int64_t shard_count_ = 0;
+
+  WorkerTeam team_;
+  std::map<int64_t, ShardTable> tables_;
+};
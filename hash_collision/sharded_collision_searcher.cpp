@@ -0,0 +1,205 @@
+#include "sharded_collision_searcher.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <utility>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "hash_string.h"
+#include "hasher.h"
+#include "shard_protocol.h"
+
+ShardedCollisionSearcher::ShardedCollisionSearcher(int64_t power,
+                                                   int64_t module,
+                                                   std::vector<int> shard_fds)
+    : power_(power), module_(module), shard_fds_(std::move(shard_fds)) {
+  if (shard_fds_.empty()) {
+    throw std::invalid_argument("At least one shard is needed");
+  }
+}
+
+ShardedCollisionSearcher::~ShardedCollisionSearcher() {
+  for (int fd : shard_fds_) {
+    SendMessage(fd, ShardMessage::kShutdown);
+    close(fd);
+  }
+}
+
+int64_t ShardedCollisionSearcher::EstimateStringLength() const {
+  return ::EstimateStringLength<LowercaseAlphabet>(module_);
+}
+
+std::string ShardedCollisionSearcher::FindCollision(const std::string& target,
+                                                    int64_t string_length) {
+  BuildShards(string_length);
+
+  int64_t shard_count = shard_fds_.size();
+  int64_t target_hash = Hash(target, power_, module_);
+  std::vector<int64_t> shifts;
+  for (int64_t length : table_lengths_) {
+    shifts.push_back(BinaryPow(power_, length, module_));
+  }
+  int64_t max_value = BinaryPow(kAlphabetSize, string_length) - 1;
+
+  std::vector<Batch> batches(shard_count);
+  HashString string(power_, module_, string_length);
+  int64_t batched = 0;
+  for (int64_t value = 0; value <= max_value; value++, ++string) {
+    for (size_t table = 0; table < shifts.size(); table++) {
+      int64_t shifted_hash =
+          (__int128_t(string.GetHash()) * shifts[table]) % module_;
+      int64_t right_hash = (target_hash - shifted_hash + module_) % module_;
+
+      Batch& batch = batches[right_hash % shard_count];
+      batch.prefixes.push_back(value);
+      batch.probes.push_back(table_lengths_[table]);
+      batch.probes.push_back(right_hash);
+      batched++;
+    }
+    if (batched < kBatchSize * shard_count && value != max_value) {
+      continue;
+    }
+
+    for (int64_t shard = 0; shard < shard_count; shard++) {
+      if (batches[shard].probes.empty()) {
+        continue;
+      }
+      if (!SendMessage(shard_fds_[shard], ShardMessage::kProbe,
+                       batches[shard].probes)) {
+        throw std::runtime_error("Shard connection is broken");
+      }
+      batches[shard].is_sent = true;
+    }
+
+    std::string result;
+    if (ReceiveResults(target, string_length, &batches, &result)) {
+      return result;
+    }
+    for (auto& sent_batch : batches) {
+      sent_batch.prefixes.clear();
+      sent_batch.probes.clear();
+    }
+    batched = 0;
+  }
+  return "";
+}
+
+void ShardedCollisionSearcher::BuildShards(int64_t length) {
+  if (!table_lengths_.empty() && table_lengths_.front() == length) {
+    return;
+  }
+  // Shards keep the previous table by the same rule.
+  bool is_previous_kept =
+      std::find(table_lengths_.begin(), table_lengths_.end(), length - 1) !=
+      table_lengths_.end();
+  table_lengths_.clear();
+
+  int64_t shard_count = shard_fds_.size();
+  for (int64_t shard = 0; shard < shard_count; shard++) {
+    std::vector<int64_t> payload = {
+        static_cast<int64_t>(GetAlphabetId<LowercaseAlphabet>()), power_,
+        module_, length, shard, shard_count};
+    if (!SendMessage(shard_fds_[shard], ShardMessage::kBuild, payload)) {
+      throw std::runtime_error("Shard connection is broken");
+    }
+  }
+
+  // Shards build their parts of the table at the same time.
+  for (int fd : shard_fds_) {
+    ShardMessage type;
+    std::vector<int64_t> payload;
+    if (!ReceiveMessage(fd, &type, &payload) ||
+        type != ShardMessage::kReady) {
+      throw std::runtime_error("Shard failed to build table");
+    }
+  }
+  table_lengths_.push_back(length);
+  if (is_previous_kept) {
+    table_lengths_.push_back(length - 1);
+  }
+}
+
+bool ShardedCollisionSearcher::ReceiveResults(const std::string& target,
+                                              int64_t length,
+                                              std::vector<Batch>* batches,
+                                              std::string* result) {
+  std::vector<pollfd> poll_fds(batches->size());
+  while (true) {
+    for (size_t shard = 0; shard < batches->size(); shard++) {
+      poll_fds[shard] = {(*batches)[shard].is_sent ? shard_fds_[shard] : -1,
+                         POLLIN, 0};
+    }
+    if (poll(poll_fds.data(), poll_fds.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error("Failed to wait for shards");
+    }
+
+    bool is_waiting = false;
+    for (size_t shard = 0; shard < batches->size(); shard++) {
+      Batch& batch = (*batches)[shard];
+      if (!batch.is_sent || poll_fds[shard].revents == 0) {
+        is_waiting = is_waiting || batch.is_sent;
+        continue;
+      }
+
+      ShardMessage type;
+      std::vector<int64_t> hits;
+      if (!ReceiveMessage(shard_fds_[shard], &type, &hits) ||
+          type != ShardMessage::kProbeResult || hits.size() % 2 != 0) {
+        throw std::runtime_error("Shard failed to probe table");
+      }
+      batch.is_sent = false;
+
+      for (size_t index = 0; index < hits.size(); index += 2) {
+        if (hits[index] < 0 ||
+            hits[index] >= static_cast<int64_t>(batch.prefixes.size())) {
+          throw std::runtime_error("Shard sent malformed result");
+        }
+        HashString prefix(power_, module_, length,
+                          batch.prefixes[hits[index]]);
+        std::string collision = prefix.Get() + DecodeString(hits[index + 1]);
+        if (!collision.empty() && collision != target) {
+          *result = collision;
+          Cancel(batches);
+          return true;
+        }
+      }
+    }
+    if (!is_waiting) {
+      return false;
+    }
+  }
+}
+
+void ShardedCollisionSearcher::Cancel(std::vector<Batch>* batches) {
+  for (size_t shard = 0; shard < batches->size(); shard++) {
+    if ((*batches)[shard].is_sent &&
+        !SendMessage(shard_fds_[shard], ShardMessage::kCancel)) {
+      throw std::runtime_error("Shard connection is broken");
+    }
+  }
+
+  // Shard may have answered the batch before it saw kCancel, so its
+  // result is skipped. kCancelled comes in both cases.
+  for (size_t shard = 0; shard < batches->size(); shard++) {
+    if (!(*batches)[shard].is_sent) {
+      continue;
+    }
+    ShardMessage type;
+    std::vector<int64_t> payload;
+    do {
+      if (!ReceiveMessage(shard_fds_[shard], &type, &payload)) {
+        throw std::runtime_error("Shard connection is broken");
+      }
+    } while (type == ShardMessage::kProbeResult);
+    if (type != ShardMessage::kCancelled) {
+      throw std::runtime_error("Shard failed to cancel batch");
+    }
+    (*batches)[shard].is_sent = false;
+  }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "../utilities.h"
+
+// Coordinator of the collision search, whose suffix tables are split
+// between ShardWorker processes. Prefixes are enumerated here, and hash
+// of the suffix each of them needs is sent to the shard, which owns it.
+// Shards keep the tables of the same lengths as HashCollisionSearcher,
+// so each prefix is probed in the tables of length and length - 1.
+// Shards are reached through connected stream sockets, so they can run
+// on this machine or on any other one.
+class ShardedCollisionSearcher {
+ public:
+  // Takes ownership of the sockets.
+  ShardedCollisionSearcher(int64_t power, int64_t module,
+                           std::vector<int> shard_fds);
+  // Stops the workers.
+  ~ShardedCollisionSearcher();
+
+  ShardedCollisionSearcher(const ShardedCollisionSearcher&) = delete;
+  ShardedCollisionSearcher& operator=(const ShardedCollisionSearcher&) =
+      delete;
+
+  // Same estimate as in HashCollisionSearcher, see ::EstimateStringLength.
+  int64_t EstimateStringLength() const;
+
+  // Throws std::runtime_error if some shard fails.
+  std::string FindCollision(const std::string& target, int64_t string_length);
+
+ private:
+  // Probes sent to one shard in one message.
+  static const int64_t kBatchSize = 4096;
+
+  struct Batch {
+    // Prefixes, whose suffixes are asked for, one per probe.
+    std::vector<int64_t> prefixes;
+    // {suffix length, suffix hash} pairs, see ShardMessage::kProbe.
+    std::vector<int64_t> probes;
+    bool is_sent = false;
+  };
+
+ private:
+  void BuildShards(int64_t length);
+  // Waits for the answers of the sent batches, cancels the rest
+  // after the first collision.
+  bool ReceiveResults(const std::string& target, int64_t length,
+                      std::vector<Batch>* batches, std::string* result);
+  void Cancel(std::vector<Batch>* batches);
+
+ private:
+  int64_t power_;
+  int64_t module_;
+  std::vector<int> shard_fds_;
+  // Lengths of the tables shards are holding now, the longest first.
+  std::vector<int64_t> table_lengths_;
+};
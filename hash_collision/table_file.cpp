@@ -0,0 +1,145 @@
+#include "table_file.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char kMagic[8] = {'H', 'C', 'T', 'A', 'B', 'L', 'E', '\0'};
+
+static_assert(sizeof(TableFileHeader) % sizeof(int64_t) == 0);
+static_assert(sizeof(HashMap::Entry) % sizeof(int64_t) == 0);
+
+class MappedFile {
+ public:
+  MappedFile(void* data, size_t size) : data_(data), size_(size) {}
+
+  ~MappedFile() {
+    munmap(data_, size_);
+  }
+
+  const char* Data() const {
+    return static_cast<const char*>(data_);
+  }
+
+ private:
+  void* data_;
+  size_t size_;
+};
+
+uint64_t Checksum(const void* data, int64_t size, uint64_t checksum) {
+  const auto* words = static_cast<const uint64_t*>(data);
+  for (int64_t index = 0; index < size / int64_t(sizeof(uint64_t)); index++) {
+    checksum = (checksum ^ words[index]) * 0x100000001b3ull;
+    checksum ^= checksum >> 32u;
+  }
+  return checksum;
+}
+
+uint64_t Checksum(const HashMap& hash_map) {
+  uint64_t checksum = 0xcbf29ce484222325ull;
+  checksum = Checksum(hash_map.GetBuckets(),
+                      hash_map.GetBucketCount() * sizeof(int64_t), checksum);
+  checksum = Checksum(hash_map.GetEntries(),
+                      hash_map.GetSize() * sizeof(HashMap::Entry), checksum);
+  return checksum;
+}
+
+}  // namespace
+
+bool SaveTable(const std::string& path, const TableParameters& parameters,
+               const HashMap& hash_map) {
+  TableFileHeader header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = TableFileHeader::kVersion;
+  header.entry_size = sizeof(HashMap::Entry);
+  header.parameters = parameters;
+  header.bucket_count = hash_map.GetBucketCount();
+  header.size = hash_map.GetSize();
+  header.checksum = Checksum(hash_map);
+
+  std::string temporary_path = path + ".tmp";
+  FILE* file = std::fopen(temporary_path.c_str(), "wb");
+  if (file == nullptr) {
+    return false;
+  }
+
+  size_t bucket_count = header.bucket_count;
+  size_t size = header.size;
+  bool is_written =
+      std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+      std::fwrite(hash_map.GetBuckets(), sizeof(int64_t), bucket_count,
+                  file) == bucket_count &&
+      std::fwrite(hash_map.GetEntries(), sizeof(HashMap::Entry), size,
+                  file) == size;
+  is_written = std::fclose(file) == 0 && is_written;
+
+  if (!is_written || std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+    std::remove(temporary_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<HashMap> LoadTable(const std::string& path,
+                                   const TableParameters& parameters) {
+  int descriptor = open(path.c_str(), O_RDONLY);
+  if (descriptor < 0) {
+    return nullptr;
+  }
+
+  struct stat file_stat{};
+  if (fstat(descriptor, &file_stat) != 0 ||
+      file_stat.st_size < int64_t(sizeof(TableFileHeader))) {
+    close(descriptor);
+    return nullptr;
+  }
+
+  size_t file_size = file_stat.st_size;
+  void* data = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, descriptor, 0);
+  close(descriptor);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+  auto mapped_file = std::make_shared<MappedFile>(data, file_size);
+
+  // Counts are checked against the file size before the multiplication,
+  // so a damaged header can't overflow the expected size.
+  TableFileHeader header{};
+  std::memcpy(&header, mapped_file->Data(), sizeof(header));
+  int64_t max_bucket_count = file_size / sizeof(int64_t);
+  int64_t max_size = file_size / sizeof(HashMap::Entry);
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != TableFileHeader::kVersion ||
+      header.entry_size != sizeof(HashMap::Entry) ||
+      header.parameters.alphabet_id != parameters.alphabet_id ||
+      header.parameters.power != parameters.power ||
+      header.parameters.module != parameters.module ||
+      header.parameters.length != parameters.length ||
+      header.parameters.second_power != parameters.second_power ||
+      header.parameters.second_module != parameters.second_module ||
+      header.bucket_count <= 0 || header.bucket_count > max_bucket_count ||
+      header.size < 0 || header.size > max_size ||
+      file_size != sizeof(header) +
+                       size_t(header.bucket_count) * sizeof(int64_t) +
+                       size_t(header.size) * sizeof(HashMap::Entry)) {
+    return nullptr;
+  }
+
+  const char* buckets = mapped_file->Data() + sizeof(header);
+  const char* entries = buckets + header.bucket_count * sizeof(int64_t);
+  auto hash_map = std::make_unique<HashMap>(
+      reinterpret_cast<const int64_t*>(buckets), header.bucket_count,
+      reinterpret_cast<const HashMap::Entry*>(entries), header.size,
+      mapped_file);
+
+  if (Checksum(*hash_map) != header.checksum) {
+    return nullptr;
+  }
+  return hash_map;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "hash_map.h"
+
+// Everything the content of suffix table depends on.
+struct TableParameters {
+  // GetAlphabetId of the alphabet.
+  uint64_t alphabet_id;
+  int64_t power;
+  int64_t module;
+  int64_t length;
+  // Second hash of DoubleHasher, zeros for a single one.
+  int64_t second_power = 0;
+  int64_t second_module = 0;
+};
+
+// Suffix table file: header, then bucket heads, then entries of HashMap,
+// all in the native byte order.
+struct TableFileHeader {
+  static const uint32_t kVersion = 3;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t entry_size;
+
+  TableParameters parameters;
+
+  int64_t bucket_count;
+  int64_t size;
+
+  // Checksum of bucket heads and entries.
+  uint64_t checksum;
+};
+
+// Writes table to a temporary file and renames it, so other processes
+// never see a partially written table.
+bool SaveTable(const std::string& path, const TableParameters& parameters,
+               const HashMap& hash_map);
+
+// Maps the file read-only, so processes share one copy of the table
+// through the page cache. Returns nullptr if file is missing, was built
+// for other parameters or is damaged.
+std::unique_ptr<HashMap> LoadTable(const std::string& path,
+                                   const TableParameters& parameters);
@@ -0,0 +1,139 @@
+#include "table_memory.h"
+
+#include <algorithm>
+#include <fstream>
+#include <new>
+#include <string>
+#include <thread>
+
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+const size_t kPageSize = 4 << 10;
+const size_t kHugePageSize = 2 << 20;
+const size_t kMaxNumaNodes = 8 * sizeof(unsigned long);
+
+size_t RoundUp(size_t size, size_t alignment) {
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+void* MapAnonymous(size_t size, int flags) {
+  return mmap(nullptr, size, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+}
+
+}  // namespace
+
+TableMemory::TableMemory(size_t size, const MemoryPolicy& policy,
+                         int numa_node)
+    : data_(MAP_FAILED),
+      size_(size),
+      mapped_size_(RoundUp(std::max<size_t>(size, 1), kPageSize)) {
+  // Huge page for a small table would mostly be wasted
+  bool use_huge_pages =
+      policy.pages != PageMode::kDefault && size >= kHugePageSize;
+  if (use_huge_pages) {
+    mapped_size_ = RoundUp(size, kHugePageSize);
+  }
+
+  if (use_huge_pages && policy.pages == PageMode::kExplicitHuge) {
+    data_ = MapAnonymous(mapped_size_, MAP_HUGETLB);
+    has_huge_pages_ = data_ != MAP_FAILED;
+  }
+  if (data_ == MAP_FAILED) {
+    data_ = MapAnonymous(mapped_size_, 0);
+    if (data_ == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    if (use_huge_pages) {
+      has_huge_pages_ = madvise(data_, mapped_size_, MADV_HUGEPAGE) == 0;
+    }
+  }
+
+  // Policy must be set before the pages are touched for the first time
+  Bind(policy, numa_node);
+}
+
+TableMemory::~TableMemory() {
+  munmap(data_, mapped_size_);
+}
+
+void* TableMemory::Data() const {
+  return data_;
+}
+
+size_t TableMemory::Size() const {
+  return size_;
+}
+
+bool TableMemory::HasHugePages() const {
+  return has_huge_pages_;
+}
+
+void TableMemory::Bind(const MemoryPolicy& policy, int numa_node) {
+  int node_count = GetNumaNodeCount();
+  if (node_count <= 1) {
+    return;
+  }
+
+  unsigned long node_mask = 0;
+  int mode = MPOL_DEFAULT;
+  if (policy.numa == NumaMode::kInterleave) {
+    mode = MPOL_INTERLEAVE;
+    node_mask = node_count >= int(kMaxNumaNodes)
+        ? ~0ul
+        : (1ul << unsigned(node_count)) - 1;
+  } else if (policy.numa == NumaMode::kReplicate && numa_node >= 0 &&
+             numa_node < int(kMaxNumaNodes)) {
+    mode = MPOL_PREFERRED;
+    node_mask = 1ul << unsigned(numa_node);
+  } else {
+    return;
+  }
+  // Failure only means that the memory stays where the kernel puts it
+  syscall(SYS_mbind, data_, mapped_size_, mode, &node_mask,
+          kMaxNumaNodes + 1, 0);
+}
+
+int GetNumaNodeCount() {
+  // Looks like "0" or "0-1"
+  static const int node_count = [] {
+    std::ifstream online("/sys/devices/system/node/online");
+    std::string nodes;
+    if (!(online >> nodes) || nodes.empty()) {
+      return 1;
+    }
+    size_t last_start = nodes.find_last_of("-,");
+    last_start = last_start == std::string::npos ? 0 : last_start + 1;
+    try {
+      return std::max(1, std::stoi(nodes.substr(last_start)) + 1);
+    } catch (const std::exception& exception) {
+      return 1;
+    }
+  }();
+  return node_count;
+}
+
+int GetCurrentNumaNode() {
+  unsigned cpu = 0;
+  unsigned node = 0;
+  if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+    return 0;
+  }
+  return int(node);
+}
+
+bool PinCurrentThread(int thread_index) {
+  unsigned core_count = std::max(1u, std::thread::hardware_concurrency());
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(thread_index % core_count, &cpu_set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set),
+                                &cpu_set) == 0;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+enum class PageMode {
+  kDefault,
+  // madvise(MADV_HUGEPAGE), works when transparent huge pages are enabled.
+  kTransparentHuge,
+  // MAP_HUGETLB, needs pages reserved in /proc/sys/vm/nr_hugepages.
+  // Falls back to kTransparentHuge when there are not enough of them.
+  kExplicitHuge,
+};
+
+enum class NumaMode {
+  kDefault,
+  // Pages of each table are spread over all NUMA nodes.
+  kInterleave,
+  // Every NUMA node gets its own copy of each table.
+  kReplicate,
+};
+
+// How suffix tables are allocated and how searcher threads are placed.
+// Everything that isn't supported by the system is silently skipped.
+struct MemoryPolicy {
+  PageMode pages = PageMode::kTransparentHuge;
+  NumaMode numa = NumaMode::kDefault;
+  // Thread with index i is pinned to core i % hardware_concurrency.
+  bool pin_threads = false;
+};
+
+// Zero-filled anonymous memory, released in destructor.
+class TableMemory {
+ public:
+  // numa_node is used with NumaMode::kReplicate, -1 means any node.
+  TableMemory(size_t size, const MemoryPolicy& policy, int numa_node = -1);
+  ~TableMemory();
+
+  TableMemory(const TableMemory&) = delete;
+  TableMemory& operator=(const TableMemory&) = delete;
+
+  void* Data() const;
+  size_t Size() const;
+  bool HasHugePages() const;
+
+ private:
+  void Bind(const MemoryPolicy& policy, int numa_node);
+
+ private:
+  void* data_;
+  size_t size_;
+  size_t mapped_size_;
+  bool has_huge_pages_ = false;
+};
+
+int GetNumaNodeCount();
+// Node of the core the calling thread is running on.
+int GetCurrentNumaNode();
+
+// Pins the calling thread, returns false if it's not possible.
+bool PinCurrentThread(int thread_index);
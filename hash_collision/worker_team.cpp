@@ -0,0 +1,84 @@
+#include "worker_team.h"
+
+#include "table_memory.h"
+
+SpinBarrier::SpinBarrier(int count)
+    : count_(count),
+      spin_count_(unsigned(count) <= std::thread::hardware_concurrency()
+                      ? kSpinCount
+                      : 0),
+      remaining_(count) {}
+
+void SpinBarrier::ArriveAndWait() {
+  int64_t round = round_.load(std::memory_order_acquire);
+  if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    // Threads of the next round arrive only after they see the new round,
+    // so they see the reset counter too.
+    remaining_.store(count_, std::memory_order_relaxed);
+    {
+      std::lock_guard lock_guard(mutex_);
+      round_.store(round + 1, std::memory_order_release);
+    }
+    cv_.notify_all();
+    return;
+  }
+
+  for (int spin = 0; spin < spin_count_; spin++) {
+    if (round_.load(std::memory_order_acquire) != round) {
+      return;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+  }
+
+  std::unique_lock unique_lock(mutex_);
+  cv_.wait(unique_lock, [this, round] {
+    return round_.load(std::memory_order_acquire) != round;
+  });
+}
+
+WorkerTeam::WorkerTeam(int thread_count, bool pin_threads)
+    : pin_threads_(pin_threads), barrier_(thread_count + 1) {
+  threads_.reserve(thread_count);
+  for (int index = 0; index < thread_count; index++) {
+    threads_.emplace_back([this, index] { Work(index); });
+  }
+}
+
+WorkerTeam::~WorkerTeam() {
+  is_stopped_ = true;
+  barrier_.ArriveAndWait();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void WorkerTeam::Run(const std::function<void(int thread_index)>& function) {
+  function_ = &function;
+  barrier_.ArriveAndWait();
+  barrier_.ArriveAndWait();
+  function_ = nullptr;
+}
+
+int WorkerTeam::GetThreadCount() const {
+  return threads_.size();
+}
+
+bool WorkerTeam::ArePinned() const {
+  return pin_threads_;
+}
+
+void WorkerTeam::Work(int thread_index) {
+  if (pin_threads_) {
+    PinCurrentThread(thread_index);
+  }
+  while (true) {
+    barrier_.ArriveAndWait();
+    if (is_stopped_) {
+      return;
+    }
+    (*function_)(thread_index);
+    barrier_.ArriveAndWait();
+  }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Barrier for a fixed number of threads, which can be passed again and
+// again. Phases of a search are often shorter than a sleep and a wakeup,
+// so threads spin for a while first and sleep only if the others are late.
+// With more threads than cores a spinning thread would only take the core
+// from the ones it waits for, so then they sleep right away.
+class SpinBarrier {
+ public:
+  explicit SpinBarrier(int count);
+
+  // Returns, once all count threads have called it in this round.
+  void ArriveAndWait();
+
+ private:
+  static const int kSpinCount = 1 << 12;
+
+ private:
+  const int count_;
+  const int spin_count_;
+  std::atomic<int> remaining_;
+  // Incremented by the last thread of each round.
+  std::atomic<int64_t> round_{0};
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+};
+
+// Threads, which are started once and then run phase after phase, so a
+// phase costs two barriers instead of starting and joining the threads.
+// Worker with index i always runs part i of a phase, and is pinned to
+// core i, if pin_threads is set, so consecutive phases over the same data
+// find it in the caches of the same core.
+class WorkerTeam {
+ public:
+  WorkerTeam(int thread_count, bool pin_threads);
+  ~WorkerTeam();
+
+  WorkerTeam(const WorkerTeam&) = delete;
+  WorkerTeam& operator=(const WorkerTeam&) = delete;
+
+  // Calls function(thread_index) in every worker and returns, once all
+  // of them have returned. Calls mustn't overlap.
+  void Run(const std::function<void(int thread_index)>& function);
+
+  int GetThreadCount() const;
+  bool ArePinned() const;
+
+ private:
+  void Work(int thread_index);
+
+ private:
+  const bool pin_threads_;
+  // Workers and the caller of Run.
+  SpinBarrier barrier_;
+  // Written before the first barrier of a phase, so workers read it
+  // without synchronization.
+  const std::function<void(int)>* function_ = nullptr;
+  bool is_stopped_ = false;
+
+  std::vector<std::thread> threads_;
+};
@@ -0,0 +1,510 @@
+#pragma once
+
+#include "promise.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Asynchronous reads and writes, which are waited for by the kernel, not
+// by a thread per request. Operations of a batch are submitted together.
+
+struct IoOperation {
+  enum Type {
+    kRead,
+    kWrite,
+  };
+
+  Type type = kRead;
+  int fd = -1;
+  char* buffer = nullptr;
+  size_t size = 0;
+  int64_t offset = 0;
+  // Gets the number of bytes or -errno. Is called in a thread of the
+  // service, so it mustn't block.
+  std::function<void(int64_t)> complete;
+};
+
+class IoService {
+ public:
+  virtual ~IoService() = default;
+
+  // Buffers must stay valid until the operations are complete.
+  virtual void Submit(std::vector<IoOperation> operations) = 0;
+};
+
+// Performs operations by pread and pwrite in a small pool, for kernels
+// without io_uring. Each operation holds a thread while it runs.
+class BlockingIoService : public IoService {
+ public:
+  explicit BlockingIoService(size_t thread_count = 4) : pool_(thread_count) {
+  }
+
+  void Submit(std::vector<IoOperation> operations) override {
+    for (IoOperation& operation : operations) {
+      pool_.Submit([operation = std::move(operation)]() {
+        ssize_t result = operation.type == IoOperation::kRead
+            ? pread(operation.fd, operation.buffer, operation.size,
+                    operation.offset)
+            : pwrite(operation.fd, operation.buffer, operation.size,
+                     operation.offset);
+        operation.complete(result < 0 ? -errno : result);
+      });
+    }
+  }
+
+ private:
+  ThreadPool pool_;
+};
+
+// io_uring by raw syscalls, so no liburing is needed. Submitters fill the
+// submission ring under a mutex and enter the kernel once per batch, one
+// thread waits for the completions and calls their callbacks. If the ring
+// fails, pending and later operations complete with the error.
+class UringIoService : public IoService {
+ public:
+  // Returns nullptr, if the kernel doesn't support io_uring.
+  static std::unique_ptr<UringIoService> Create(unsigned entries = 256);
+  ~UringIoService() override;
+
+  UringIoService(const UringIoService&) = delete;
+  UringIoService& operator=(const UringIoService&) = delete;
+
+  void Submit(std::vector<IoOperation> operations) override;
+
+ private:
+  // Slot of an operation in flight, its index plus one is the user data
+  // of the entry.
+  struct Request {
+    iovec iov;
+    std::function<void(int64_t)> complete;
+  };
+
+  UringIoService() = default;
+  bool Setup(unsigned entries);
+  // Adds an entry to the submission ring, kStopRequest stops the
+  // completion thread.
+  void Push(uint8_t opcode, int fd, uint64_t request, int64_t offset);
+  // Returns 0 or errno, to_submit is left with the entries, which the
+  // kernel hasn't taken.
+  int Enter(unsigned* to_submit);
+  void Complete();
+  // Completes the pending operations with the error, as the ring can't be
+  // used anymore.
+  void Fail(int error);
+
+  static constexpr uint64_t kStopRequest = 0;
+
+  static std::atomic<unsigned>* AsAtomic(unsigned* value) {
+    return reinterpret_cast<std::atomic<unsigned>*>(value);
+  }
+
+ private:
+  int ring_fd_ = -1;
+  unsigned entries_ = 0;
+
+  void* sq_ring_ = nullptr;
+  size_t sq_ring_size_ = 0;
+  void* cq_ring_ = nullptr;
+  size_t cq_ring_size_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+
+  unsigned* sq_tail_ = nullptr;
+  unsigned* sq_mask_ = nullptr;
+  unsigned* sq_array_ = nullptr;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned* cq_mask_ = nullptr;
+  io_uring_cqe* cqes_ = nullptr;
+
+  // Requests in flight are limited by the size of the rings, so neither
+  // of them overflows.
+  std::mutex mutex_;
+  std::condition_variable not_full_cv_;
+  std::vector<Request> requests_;
+  std::vector<unsigned> free_requests_;
+  unsigned in_flight_count_ = 0;
+  int error_ = 0;
+
+  std::thread thread_;
+};
+
+inline std::unique_ptr<UringIoService> UringIoService::Create(
+    unsigned entries) {
+  std::unique_ptr<UringIoService> service(new UringIoService());
+  if (!service->Setup(entries)) {
+    return nullptr;
+  }
+  service->thread_ = std::thread([service = service.get()] {
+    service->Complete();
+  });
+  return service;
+}
+
+inline bool UringIoService::Setup(unsigned entries) {
+  io_uring_params params{};
+  ring_fd_ = syscall(__NR_io_uring_setup, entries, &params);
+  if (ring_fd_ < 0) {
+    return false;
+  }
+  entries_ = params.sq_entries;
+  requests_.resize(entries_);
+  free_requests_.reserve(entries_);
+  for (unsigned index = entries_; index > 0; index--) {
+    free_requests_.push_back(index - 1);
+  }
+
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool is_single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (is_single_mmap) {
+    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+  }
+
+  sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED) {
+    sq_ring_ = nullptr;
+    return false;
+  }
+  if (is_single_mmap) {
+    cq_ring_ = sq_ring_;
+  } else {
+    cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED) {
+      cq_ring_ = nullptr;
+      return false;
+    }
+  }
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    return false;
+  }
+  sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+  auto* sq = static_cast<char*>(sq_ring_);
+  sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  auto* cq = static_cast<char*>(cq_ring_);
+  cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+  return true;
+}
+
+inline UringIoService::~UringIoService() {
+  if (thread_.joinable()) {
+    // Completions come in any order, so the stop request goes last.
+    std::unique_lock unique_lock(mutex_);
+    not_full_cv_.wait(unique_lock, [this] { return in_flight_count_ == 0; });
+    // After a failure the thread has stopped by itself.
+    if (error_ == 0) {
+      Push(IORING_OP_NOP, -1, kStopRequest, 0);
+      unsigned to_submit = 1;
+      if (Enter(&to_submit) != 0) {
+        // Thread can't be woken, so it is left with the rings.
+        thread_.detach();
+        return;
+      }
+    }
+    unique_lock.unlock();
+    thread_.join();
+  }
+
+  if (sqes_ != nullptr) {
+    munmap(sqes_, sqes_size_);
+  }
+  if (cq_ring_ != nullptr && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  if (sq_ring_ != nullptr) {
+    munmap(sq_ring_, sq_ring_size_);
+  }
+  if (ring_fd_ >= 0) {
+    close(ring_fd_);
+  }
+}
+
+inline void UringIoService::Submit(std::vector<IoOperation> operations) {
+  std::unique_lock unique_lock(mutex_);
+  size_t index = 0;
+  int error = 0;
+  while (index < operations.size() && error == 0) {
+    not_full_cv_.wait(unique_lock, [this] {
+      return in_flight_count_ < entries_ || error_ != 0;
+    });
+    if (error_ != 0) {
+      error = error_;
+      break;
+    }
+
+    unsigned to_submit = 0;
+    for (; index < operations.size() && in_flight_count_ < entries_;
+         index++) {
+      IoOperation& operation = operations[index];
+      unsigned request = free_requests_.back();
+      free_requests_.pop_back();
+      requests_[request] = {{operation.buffer, operation.size},
+                            std::move(operation.complete)};
+      Push(operation.type == IoOperation::kRead ? IORING_OP_READV
+                                                : IORING_OP_WRITEV,
+           operation.fd, request + 1, operation.offset);
+      in_flight_count_++;
+      to_submit++;
+    }
+
+    error = Enter(&to_submit);
+    if (error != 0) {
+      // The kernel takes the entries in order, so the ones it hasn't taken
+      // are the last and are removed from the ring.
+      unsigned tail = *sq_tail_ - to_submit;
+      for (unsigned offset = 0; offset < to_submit; offset++) {
+        const io_uring_sqe& sqe = sqes_[(tail + offset) & *sq_mask_];
+        unsigned request = sqe.user_data - 1;
+        operations[index - to_submit + offset].complete =
+            std::move(requests_[request].complete);
+        requests_[request].complete = nullptr;
+        free_requests_.push_back(request);
+      }
+      AsAtomic(sq_tail_)->store(tail, std::memory_order_release);
+      in_flight_count_ -= to_submit;
+      index -= to_submit;
+    }
+  }
+  unique_lock.unlock();
+
+  // Operations, which weren't submitted, fail with the error.
+  for (; index < operations.size(); index++) {
+    operations[index].complete(-error);
+  }
+}
+
+inline void UringIoService::Push(uint8_t opcode, int fd, uint64_t request,
+                                 int64_t offset) {
+  // Only submitters write the tail, and they hold the mutex.
+  unsigned tail = *sq_tail_;
+  unsigned index = tail & *sq_mask_;
+
+  io_uring_sqe* sqe = &sqes_[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->off = offset;
+  if (request != kStopRequest) {
+    sqe->addr = reinterpret_cast<uint64_t>(&requests_[request - 1].iov);
+    sqe->len = 1;
+  }
+  sqe->user_data = request;
+
+  sq_array_[index] = index;
+  AsAtomic(sq_tail_)->store(tail + 1, std::memory_order_release);
+}
+
+inline int UringIoService::Enter(unsigned* to_submit) {
+  while (*to_submit > 0) {
+    int submitted = syscall(__NR_io_uring_enter, ring_fd_, *to_submit, 0, 0,
+                            nullptr, 0);
+    if (submitted < 0) {
+      if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+        continue;
+      }
+      return errno;
+    }
+    *to_submit -= submitted;
+  }
+  return 0;
+}
+
+inline void UringIoService::Complete() {
+  std::vector<unsigned> completed;
+  completed.reserve(entries_);
+  bool is_stopped = false;
+  while (!is_stopped) {
+    int result = syscall(__NR_io_uring_enter, ring_fd_, 0, 1,
+                         IORING_ENTER_GETEVENTS, nullptr, 0);
+    if (result < 0 && errno != EINTR) {
+      Fail(errno);
+      return;
+    }
+
+    // Completed requests were pushed before the tail, which the kernel has
+    // read, the load makes it visible to the memory model as well.
+    AsAtomic(sq_tail_)->load(std::memory_order_acquire);
+    unsigned head = *cq_head_;
+    unsigned tail = AsAtomic(cq_tail_)->load(std::memory_order_acquire);
+    for (; head != tail; head++) {
+      const io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+      if (cqe.user_data == kStopRequest) {
+        is_stopped = true;
+        continue;
+      }
+      // Request isn't reused, until it is freed under the mutex.
+      Request& request = requests_[cqe.user_data - 1];
+      request.complete(cqe.res);
+      request.complete = nullptr;
+      completed.push_back(cqe.user_data - 1);
+    }
+    AsAtomic(cq_head_)->store(head, std::memory_order_release);
+
+    if (!completed.empty()) {
+      std::lock_guard lock_guard(mutex_);
+      free_requests_.insert(free_requests_.end(), completed.begin(),
+                            completed.end());
+      in_flight_count_ -= completed.size();
+      not_full_cv_.notify_all();
+      completed.clear();
+    }
+  }
+}
+
+inline void UringIoService::Fail(int error) {
+  std::vector<std::function<void(int64_t)>> pending;
+  {
+    std::lock_guard lock_guard(mutex_);
+    error_ = error;
+    for (Request& request : requests_) {
+      if (request.complete != nullptr) {
+        pending.push_back(std::move(request.complete));
+        request.complete = nullptr;
+      }
+    }
+    in_flight_count_ = 0;
+    not_full_cv_.notify_all();
+  }
+  for (auto& complete : pending) {
+    complete(-error);
+  }
+}
+
+// io_uring, if the kernel supports it, otherwise the blocking pool.
+inline IoService& GetDefaultIoService() {
+  // Never destroyed, as the other shared services.
+  static IoService* io_service = []() -> IoService* {
+    if (auto uring = UringIoService::Create()) {
+      return uring.release();
+    }
+    return new BlockingIoService();
+  }();
+  return *io_service;
+}
+
+struct IoRange {
+  int64_t offset;
+  size_t size;
+};
+
+// Promises of the ranges of the file, submitted as one batch. Near the
+// end of the file the strings are shorter, errors are thrown from Wait as
+// std::system_error. Continuations run on executor, not on the thread of
+// the service.
+inline std::vector<std::shared_ptr<Promise<std::string>>> AsyncReadRanges(
+    int fd, const std::vector<IoRange>& ranges,
+    std::shared_ptr<Executor> executor = GetDefaultExecutor(),
+    IoService* io_service = &GetDefaultIoService()) {
+  struct Request {
+    std::string buffer;
+    int64_t result = 0;
+  };
+
+  std::vector<std::shared_ptr<Promise<std::string>>> promises;
+  std::vector<IoOperation> operations;
+  promises.reserve(ranges.size());
+  operations.reserve(ranges.size());
+  for (const IoRange& range : ranges) {
+    auto request = std::make_shared<Request>();
+    request->buffer.resize(range.size);
+    auto next = MakeFunctionTask<std::string>([request]() {
+      if (request->result < 0) {
+        throw std::system_error(-request->result, std::system_category(),
+                                "AsyncRead");
+      }
+      request->buffer.resize(request->result);
+      return std::move(request->buffer);
+    });
+
+    IoOperation operation;
+    operation.type = IoOperation::kRead;
+    operation.fd = fd;
+    operation.buffer = request->buffer.data();
+    operation.size = range.size;
+    operation.offset = range.offset;
+    operation.complete = [request, next, executor](int64_t result) {
+      request->result = result;
+      next->Execute(executor.get());
+    };
+    operations.push_back(std::move(operation));
+    promises.push_back(std::make_shared<Promise<std::string>>(next, executor));
+  }
+  io_service->Submit(std::move(operations));
+  return promises;
+}
+
+inline std::shared_ptr<Promise<std::string>> AsyncRead(
+    int fd, int64_t offset, size_t size,
+    std::shared_ptr<Executor> executor = GetDefaultExecutor(),
+    IoService* io_service = &GetDefaultIoService()) {
+  return AsyncReadRanges(fd, {{offset, size}}, std::move(executor),
+                         io_service)[0];
+}
+
+// Promise of the number of written bytes, which may be less than the size
+// of data, like for pwrite.
+inline std::shared_ptr<Promise<size_t>> AsyncWrite(
+    int fd, int64_t offset, std::string data,
+    std::shared_ptr<Executor> executor = GetDefaultExecutor(),
+    IoService* io_service = &GetDefaultIoService()) {
+  struct Request {
+    std::string buffer;
+    int64_t result = 0;
+  };
+  auto request = std::make_shared<Request>();
+  request->buffer = std::move(data);
+  auto next = MakeFunctionTask<size_t>([request]() {
+    if (request->result < 0) {
+      throw std::system_error(-request->result, std::system_category(),
+                              "AsyncWrite");
+    }
+    return static_cast<size_t>(request->result);
+  });
+
+  IoOperation operation;
+  operation.type = IoOperation::kWrite;
+  operation.fd = fd;
+  operation.buffer = request->buffer.data();
+  operation.size = request->buffer.size();
+  operation.offset = offset;
+  operation.complete = [request, next, executor](int64_t result) {
+    request->result = result;
+    next->Execute(executor.get());
+  };
+
+  std::vector<IoOperation> operations;
+  operations.push_back(std::move(operation));
+  io_service->Submit(std::move(operations));
+  return std::make_shared<Promise<size_t>>(std::move(next),
+                                           std::move(executor));
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+
+// Is thrown from Wait of the promises, which were cancelled before their
+// functions had started, or whose functions stopped on the token.
+class CancelledError : public std::runtime_error {
+ public:
+  CancelledError() : std::runtime_error("promise is cancelled") {
+  }
+};
+
+// Cancellation is cooperative: promises check the token before their
+// functions start, running functions poll it themselves.
+class CancellationToken {
+ public:
+  // Token, which is never cancelled.
+  CancellationToken() = default;
+
+  bool IsCancelled() const {
+    return is_cancelled_ != nullptr && is_cancelled_->load();
+  }
+
+  void ThrowIfCancelled() const {
+    if (IsCancelled()) {
+      throw CancelledError();
+    }
+  }
+
+ private:
+  friend class CancellationSource;
+
+  explicit CancellationToken(
+      std::shared_ptr<const std::atomic<bool>> is_cancelled)
+      : is_cancelled_(std::move(is_cancelled)) {
+  }
+
+ private:
+  std::shared_ptr<const std::atomic<bool>> is_cancelled_;
+};
+
+class CancellationSource {
+ public:
+  CancellationSource()
+      : is_cancelled_(std::make_shared<std::atomic<bool>>(false)) {
+  }
+
+  void Cancel() {
+    is_cancelled_->store(true);
+  }
+
+  bool IsCancelled() const {
+    return is_cancelled_->load();
+  }
+
+  CancellationToken GetToken() const {
+    return CancellationToken(is_cancelled_);
+  }
+
+ private:
+  std::shared_ptr<std::atomic<bool>> is_cancelled_;
+};
@@ -0,0 +1,450 @@
+#pragma once
+
+#include "promise.h"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// Bounded lock-free queue of many producers and consumers. Each cell has
+// a sequence number, which tells, whether the cell is free for the push
+// of the position or holds the value for the pop of it, so a push or
+// a pop takes one compare-exchange of the position and no locks.
+template<typename ValueType>
+class BoundedQueue {
+ public:
+  // Capacity is rounded up to a power of two, at least 2, as with a single
+  // cell the sequence of a pushed value would be that of the next push.
+  explicit BoundedQueue(size_t capacity);
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  // Value is moved from only if the queue isn't full.
+  bool TryPush(ValueType&& value);
+  std::optional<ValueType> TryPop();
+
+  size_t GetCapacity() const;
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    std::optional<ValueType> value;
+  };
+
+  // Positions are changed by different sides, so they don't share
+  // a cache line.
+  static const size_t kCacheLineSize = 64;
+
+ private:
+  const size_t mask_;
+  std::unique_ptr<Cell[]> cells_;
+  alignas(kCacheLineSize) std::atomic<size_t> push_position_ = 0;
+  alignas(kCacheLineSize) std::atomic<size_t> pop_position_ = 0;
+};
+
+template<typename ValueType>
+BoundedQueue<ValueType>::BoundedQueue(size_t capacity)
+    : mask_([capacity] {
+        size_t size = 2;
+        while (size < capacity) {
+          size *= 2;
+        }
+        return size - 1;
+      }()),
+      cells_(new Cell[mask_ + 1]) {
+  for (size_t index = 0; index <= mask_; index++) {
+    cells_[index].sequence.store(index, std::memory_order_relaxed);
+  }
+}
+
+template<typename ValueType>
+bool BoundedQueue<ValueType>::TryPush(ValueType&& value) {
+  size_t position = push_position_.load(std::memory_order_relaxed);
+  while (true) {
+    Cell& cell = cells_[position & mask_];
+    size_t sequence = cell.sequence.load(std::memory_order_acquire);
+    auto difference = static_cast<intptr_t>(sequence - position);
+    if (difference == 0) {
+      if (push_position_.compare_exchange_weak(position, position + 1,
+                                               std::memory_order_relaxed)) {
+        cell.value.emplace(std::move(value));
+        cell.sequence.store(position + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (difference < 0) {
+      // Cell still holds the value of the previous rotation.
+      return false;
+    } else {
+      position = push_position_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+template<typename ValueType>
+std::optional<ValueType> BoundedQueue<ValueType>::TryPop() {
+  size_t position = pop_position_.load(std::memory_order_relaxed);
+  while (true) {
+    Cell& cell = cells_[position & mask_];
+    size_t sequence = cell.sequence.load(std::memory_order_acquire);
+    auto difference = static_cast<intptr_t>(sequence - (position + 1));
+    if (difference == 0) {
+      if (pop_position_.compare_exchange_weak(position, position + 1,
+                                              std::memory_order_relaxed)) {
+        std::optional<ValueType> value = std::move(cell.value);
+        cell.value.reset();
+        cell.sequence.store(position + mask_ + 1, std::memory_order_release);
+        return value;
+      }
+    } else if (difference < 0) {
+      // Value of the position isn't pushed yet.
+      return std::nullopt;
+    } else {
+      position = pop_position_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+template<typename ValueType>
+size_t BoundedQueue<ValueType>::GetCapacity() const {
+  return mask_ + 1;
+}
+
+class ChannelClosedError : public std::runtime_error {
+ public:
+  ChannelClosedError() : std::runtime_error("channel is closed") {
+  }
+};
+
+// Stream of values between producers and consumers, which wait for each
+// other through promises instead of threads. Values go through
+// a BoundedQueue, so while it is neither full nor empty, Send and Receive
+// take no locks. Producers, which find it full, and consumers, which find
+// it empty, are parked in the lists under a mutex with their promises,
+// and the other side fulfills them, once it has made room or values.
+// So a full channel suspends the producers, but holds none of their
+// threads, as long as they wait by Then rather than by Wait.
+// Values of a producer keep their order, if it waits for Send before
+// sending the next one.
+template<typename ValueType>
+class Channel {
+ public:
+  explicit Channel(size_t capacity);
+
+  Channel(const Channel&) = delete;
+  Channel& operator=(const Channel&) = delete;
+
+  // Value is moved from only on success.
+  bool TrySend(ValueType&& value);
+  // Promise is ready, once the value is in the channel. After Close it
+  // rethrows ChannelClosedError.
+  std::shared_ptr<Promise<void>> Send(
+      ValueType value,
+      std::shared_ptr<Executor> executor = GetDefaultExecutor());
+
+  std::optional<ValueType> TryReceive();
+  // Promise of 1 to max_count values, or of none, once the channel is
+  // closed and all the values are received. Throws std::invalid_argument,
+  // if max_count is 0, as such a receive would never be fulfilled.
+  std::shared_ptr<Promise<std::vector<ValueType>>> Receive(
+      size_t max_count,
+      std::shared_ptr<Executor> executor = GetDefaultExecutor());
+
+  // Must be called after all the Sends, values of the parked producers
+  // are still delivered.
+  void Close();
+  bool IsClosed() const;
+
+  size_t GetCapacity() const;
+
+ private:
+  struct ParkedSend {
+    ValueType value;
+    std::shared_ptr<FunctionExecutor<void>> next;
+    std::shared_ptr<Executor> executor;
+  };
+
+  struct ParkedReceive {
+    size_t max_count;
+    std::shared_ptr<std::vector<ValueType>> values;
+    std::shared_ptr<FunctionExecutor<std::vector<ValueType>>> next;
+    std::shared_ptr<Executor> executor;
+  };
+
+  // Promises, which are fulfilled after the mutex is released.
+  struct Fulfilled {
+    std::vector<ParkedSend> sends;
+    std::vector<ParkedReceive> receives;
+  };
+
+ private:
+  // Called after a push or a pop, which may let the parked ones go on.
+  void Notify();
+  // Moves values of the parked producers to the queue and values of the
+  // queue to the parked consumers, while any of them can move.
+  void Drain(Fulfilled* fulfilled);
+  // Called after the parked one is added, so either it is drained here,
+  // or the other side sees it in Notify.
+  void DrainParked(std::unique_lock<std::mutex>* unique_lock);
+  static void Fulfill(Fulfilled* fulfilled);
+
+ private:
+  BoundedQueue<ValueType> queue_;
+  std::atomic<bool> is_closed_ = false;
+  // Number of the parked ones, so Notify locks only if there are any.
+  std::atomic<size_t> parked_count_ = 0;
+
+  std::mutex mutex_;
+  std::deque<ParkedSend> parked_sends_;
+  std::deque<ParkedReceive> parked_receives_;
+};
+
+template<typename ValueType>
+Channel<ValueType>::Channel(size_t capacity) : queue_(capacity) {
+}
+
+template<typename ValueType>
+bool Channel<ValueType>::TrySend(ValueType&& value) {
+  if (is_closed_.load() || !queue_.TryPush(std::move(value))) {
+    return false;
+  }
+  Notify();
+  return true;
+}
+
+template<typename ValueType>
+std::shared_ptr<Promise<void>> Channel<ValueType>::Send(
+    ValueType value, std::shared_ptr<Executor> executor) {
+  InlineExecutor inline_executor;
+  if (is_closed_.load()) {
+    auto next = MakeFunctionTask<void>([]() { throw ChannelClosedError(); });
+    next->Execute(&inline_executor);
+    return std::make_shared<Promise<void>>(std::move(next),
+                                           std::move(executor));
+  }
+
+  auto next = MakeFunctionTask<void>([]() {});
+  if (queue_.TryPush(std::move(value))) {
+    Notify();
+    next->Execute(&inline_executor);
+    return std::make_shared<Promise<void>>(std::move(next),
+                                           std::move(executor));
+  }
+
+  std::unique_lock unique_lock(mutex_);
+  parked_sends_.push_back({std::move(value), next, executor});
+  DrainParked(&unique_lock);
+  return std::make_shared<Promise<void>>(std::move(next), std::move(executor));
+}
+
+template<typename ValueType>
+std::optional<ValueType> Channel<ValueType>::TryReceive() {
+  std::optional<ValueType> value = queue_.TryPop();
+  if (value.has_value()) {
+    Notify();
+  }
+  return value;
+}
+
+template<typename ValueType>
+std::shared_ptr<Promise<std::vector<ValueType>>> Channel<ValueType>::Receive(
+    size_t max_count, std::shared_ptr<Executor> executor) {
+  if (max_count == 0) {
+    throw std::invalid_argument("Receive of no values");
+  }
+  auto values = std::make_shared<std::vector<ValueType>>();
+  auto next = MakeFunctionTask<std::vector<ValueType>>([values]() {
+    return std::move(*values);
+  });
+
+  while (values->size() < max_count) {
+    std::optional<ValueType> value = queue_.TryPop();
+    if (!value.has_value()) {
+      break;
+    }
+    values->push_back(std::move(*value));
+  }
+  if (!values->empty()) {
+    Notify();
+    InlineExecutor inline_executor;
+    next->Execute(&inline_executor);
+    return std::make_shared<Promise<std::vector<ValueType>>>(
+        std::move(next), std::move(executor));
+  }
+
+  std::unique_lock unique_lock(mutex_);
+  parked_receives_.push_back({max_count, std::move(values), next, executor});
+  DrainParked(&unique_lock);
+  return std::make_shared<Promise<std::vector<ValueType>>>(
+      std::move(next), std::move(executor));
+}
+
+template<typename ValueType>
+void Channel<ValueType>::Close() {
+  is_closed_.store(true);
+  std::unique_lock unique_lock(mutex_);
+  DrainParked(&unique_lock);
+}
+
+template<typename ValueType>
+bool Channel<ValueType>::IsClosed() const {
+  return is_closed_.load();
+}
+
+template<typename ValueType>
+size_t Channel<ValueType>::GetCapacity() const {
+  return queue_.GetCapacity();
+}
+
+template<typename ValueType>
+void Channel<ValueType>::Notify() {
+  // Writes of the count are read-modify-writes too, so they are ordered
+  // with this one: either it sees the parked one, or the drain of
+  // DrainParked comes after it and sees the push or the pop.
+  if (parked_count_.fetch_add(0, std::memory_order_acq_rel) == 0) {
+    return;
+  }
+  Fulfilled fulfilled;
+  {
+    std::lock_guard lock_guard(mutex_);
+    Drain(&fulfilled);
+  }
+  Fulfill(&fulfilled);
+}
+
+template<typename ValueType>
+void Channel<ValueType>::DrainParked(
+    std::unique_lock<std::mutex>* unique_lock) {
+  parked_count_.exchange(parked_sends_.size() + parked_receives_.size(),
+                         std::memory_order_acq_rel);
+  Fulfilled fulfilled;
+  Drain(&fulfilled);
+  unique_lock->unlock();
+  Fulfill(&fulfilled);
+}
+
+template<typename ValueType>
+void Channel<ValueType>::Drain(Fulfilled* fulfilled) {
+  bool is_moved = true;
+  while (is_moved) {
+    is_moved = false;
+    while (!parked_sends_.empty() &&
+           queue_.TryPush(std::move(parked_sends_.front().value))) {
+      fulfilled->sends.push_back(std::move(parked_sends_.front()));
+      parked_sends_.pop_front();
+      is_moved = true;
+    }
+
+    while (!parked_receives_.empty()) {
+      ParkedReceive& receive = parked_receives_.front();
+      while (receive.values->size() < receive.max_count) {
+        std::optional<ValueType> value = queue_.TryPop();
+        if (!value.has_value()) {
+          break;
+        }
+        receive.values->push_back(std::move(*value));
+      }
+      // Once the channel is closed and drained, consumers get nothing.
+      bool is_finished = is_closed_.load() && parked_sends_.empty();
+      if (receive.values->empty() && !is_finished) {
+        break;
+      }
+      fulfilled->receives.push_back(std::move(receive));
+      parked_receives_.pop_front();
+      is_moved = true;
+    }
+  }
+  parked_count_.exchange(parked_sends_.size() + parked_receives_.size(),
+                         std::memory_order_acq_rel);
+}
+
+template<typename ValueType>
+void Channel<ValueType>::Fulfill(Fulfilled* fulfilled) {
+  // Continuations run on the executors of their promises, not in the
+  // thread of the other side.
+  for (ParkedSend& send : fulfilled->sends) {
+    send.next->Execute(send.executor.get());
+  }
+  for (ParkedReceive& receive : fulfilled->receives) {
+    receive.next->Execute(receive.executor.get());
+  }
+}
+
+// Calls function(std::vector<ValueType>) for batches of up to max_count
+// values, until the channel is closed and drained, one batch at a time.
+// Waiting for values holds no thread: the next batch is requested from
+// the task, which has consumed the previous one. Function is called only
+// on executor, each batch in its own task. Promise is ready after the last
+// batch, if the function throws, it stops and the promise rethrows.
+template<typename ValueType, typename Function>
+std::shared_ptr<Promise<void>> ForEachBatch(
+    std::shared_ptr<Channel<ValueType>> channel, Function function,
+    size_t max_count,
+    std::shared_ptr<Executor> executor = GetDefaultExecutor()) {
+  if (max_count == 0) {
+    throw std::invalid_argument("ForEachBatch of no values");
+  }
+
+  struct Consumer {
+    std::shared_ptr<Channel<ValueType>> channel;
+    Function function;
+    size_t max_count;
+    std::shared_ptr<Executor> executor;
+    std::exception_ptr exception;
+    std::shared_ptr<FunctionExecutor<void>> done;
+
+    // Returns whether to go on.
+    bool Consume(FunctionExecutor<std::vector<ValueType>>* batch) {
+      std::vector<ValueType> values = batch->Take();
+      if (!values.empty()) {
+        try {
+          function(std::move(values));
+          return true;
+        } catch (...) {
+          exception = std::current_exception();
+        }
+      }
+      // Consumer holds done only until it is submitted, so there is
+      // no cycle.
+      auto finished_done = std::move(done);
+      finished_done->Execute(executor.get());
+      return false;
+    }
+
+    static void Receive(const std::shared_ptr<Consumer>& consumer) {
+      auto promise = consumer->channel->Receive(consumer->max_count,
+                                                consumer->executor);
+      auto batch = promise->GetFunctionExecutor();
+      // Callback is called right away for a ready batch, otherwise in the
+      // thread, which fulfills it, either way the batch is consumed in a
+      // new task. Promise is released after the subscription, so it
+      // doesn't wait.
+      batch->Subscribe([consumer, batch]() {
+        consumer->executor->Submit([consumer, batch]() {
+          if (consumer->Consume(batch.get())) {
+            Receive(consumer);
+          }
+        });
+      });
+    }
+  };
+
+  auto consumer = std::make_shared<Consumer>(
+      Consumer{std::move(channel), std::move(function), max_count, executor,
+               nullptr, nullptr});
+  auto done = MakeFunctionTask<void>([consumer]() {
+    if (consumer->exception != nullptr) {
+      std::rethrow_exception(consumer->exception);
+    }
+  });
+  consumer->done = done;
+  auto promise = std::make_shared<Promise<void>>(std::move(done), executor);
+  executor->Submit([consumer]() { Consumer::Receive(consumer); });
+  return promise;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+
+// Runs tasks of the promises. Tasks may be run in any order and on any
+// thread, but each one exactly once.
+class Executor {
+ public:
+  virtual ~Executor() = default;
+
+  virtual void Submit(std::function<void()> task) = 0;
+};
+
+// Runs task right in Submit, in the calling thread.
+class InlineExecutor : public Executor {
+ public:
+  void Submit(std::function<void()> task) override {
+    task();
+  }
+};
+
+// Shared ThreadPool, which is used by promises without explicit executor.
+std::shared_ptr<Executor> GetDefaultExecutor();
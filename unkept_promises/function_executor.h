@@ -1,88 +1,309 @@
 #pragma once
 
-#include <condition_variable>
+#include "executor.h"
+#include "futex.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <optional>
 #include <thread>
+#include <type_traits>
+#include <utility>
 
+// Storage of the function result inside the shared state, so no separate
+// allocation is needed and move-only types are supported.
 template<typename ResultType>
-class FunctionExecutor {
+struct ResultStorage {
+  template<typename Function>
+  void Store(Function& function) {
+    value.emplace(function());
+  }
+
+  std::optional<ResultType> value;
+};
+
+template<>
+struct ResultStorage<void> {
+  template<typename Function>
+  void Store(Function& function) {
+    function();
+  }
+};
+
+// Shared state of a promise: result or exception of the function and
+// continuations, which are waiting for them. Lock-free: result is
+// published by the store to state_, waiters spin for a while and then
+// park on state_ with futex.
+template<typename ResultType>
+class FunctionExecutor
+    : public std::enable_shared_from_this<FunctionExecutor<ResultType>> {
  public:
-  ~FunctionExecutor();
+  using WaitResult =
+      std::conditional_t<std::is_void_v<ResultType>, void,
+                         std::add_lvalue_reference_t<const ResultType>>;
 
-  void Execute(std::function<ResultType()> function);
+ public:
+  virtual ~FunctionExecutor();
 
-  ResultType Wait();
+  // Submits the function. State keeps itself alive until it returns.
+  // If executor throws, the exception becomes the result.
+  void Execute(Executor* executor);
+
+  // Reference stays valid while the state is alive.
+  WaitResult Wait();
+  // Moves the result out of the state, so later calls get moved-from one.
+  ResultType Take();
+  void WaitForResult();
+  // Returns whether the result is ready. Doesn't run other tasks, as they
+  // may take longer than timeout.
+  bool WaitForResultFor(std::chrono::nanoseconds timeout);
+  bool IsReady() const;
+
+  // Calls callback once the result is ready: right away, if it is ready
+  // already, otherwise in the thread, which sets the result. Callback
+  // mustn't block, as it delays the other callbacks.
+  void Subscribe(std::function<void()> callback);
+  bool HasSubscribers() const;
+
+ protected:
+  // Calls the function and stores its result.
+  virtual void Invoke(ResultStorage<ResultType>* storage) = 0;
+
+ private:
+  enum State : uint32_t {
+    kPending = 0,
+    kReady = 1,
+  };
+
+  struct Callback {
+    std::function<void()> function;
+    Callback* next;
+  };
+
+  // Waiting is usually short when the function is already running,
+  // so a few checks are cheaper than a syscall.
+  static const int kSpinCount = 128;
+  // How often a blocked worker looks for new tasks of its pool.
+  static constexpr std::chrono::microseconds kHelpInterval{500};
 
  private:
-  std::shared_ptr<ResultType> result_;
-  std::mutex result_mutex_;
-  std::condition_variable cv_;
+  void Run();
+  void RethrowException() const;
+  void SetReady();
+  // Marks list as closed, no callbacks can be added after it.
+  static Callback* Closed();
 
+ private:
+  ResultStorage<ResultType> result_;
   std::exception_ptr exception_;
 
-  bool is_result_ready_ = false;
-  std::thread thread_;
+  std::atomic<uint32_t> state_ = kPending;
+  std::atomic<uint32_t> parked_count_ = 0;
+
+  // Stack of callbacks, Closed() once they were started.
+  std::atomic<Callback*> callbacks_ = nullptr;
+  std::atomic<bool> has_subscribers_ = false;
+
+  // Set while the function is submitted. Task holds a raw pointer, which
+  // fits into std::function without allocation.
+  std::shared_ptr<FunctionExecutor> self_;
 };
 
-template<typename ResultType>
-void
-FunctionExecutor<ResultType>::Execute(std::function<ResultType()> function) {
-  thread_ = std::thread([this, function]() {
-    std::unique_lock<std::mutex> unique_lock(result_mutex_);
+// State, callable and result share the allocation of make_shared.
+template<typename ResultType, typename Function>
+class FunctionTask final : public FunctionExecutor<ResultType> {
+ public:
+  explicit FunctionTask(Function function) : function_(std::move(function)) {
+  }
 
+ protected:
+  void Invoke(ResultStorage<ResultType>* storage) override {
+    // Captures of the function, like the previous promises of a chain,
+    // are released as soon as they aren't needed, even if it has thrown.
     try {
-      result_ = std::make_shared<ResultType>(function());
-    } catch (const std::exception& exception) {
-      exception_ = std::current_exception();
+      storage->Store(*function_);
+    } catch (...) {
+      function_.reset();
+      throw;
     }
-    is_result_ready_ = true;
+    function_.reset();
+  }
+
+ private:
+  std::optional<Function> function_;
+};
 
-    unique_lock.unlock();
-    cv_.notify_one();
-  });
+template<typename ResultType, typename Function>
+std::shared_ptr<FunctionExecutor<ResultType>> MakeFunctionTask(
+    Function function) {
+  return std::make_shared<FunctionTask<ResultType, Function>>(
+      std::move(function));
 }
 
-template<>
-void FunctionExecutor<void>::Execute(std::function<void()> function) {
-  thread_ = std::thread([this, function]() {
-    std::unique_lock<std::mutex> unique_lock(result_mutex_);
+template<typename ResultType>
+FunctionExecutor<ResultType>::~FunctionExecutor() {
+  Callback* callback = callbacks_.load();
+  while (callback != nullptr && callback != Closed()) {
+    delete std::exchange(callback, callback->next);
+  }
+}
 
-    try {
-      function();
-    } catch (const std::exception& exception) {
-      exception_ = std::current_exception();
+template<typename ResultType>
+void FunctionExecutor<ResultType>::Execute(Executor* executor) {
+  self_ = this->shared_from_this();
+  try {
+    executor->Submit([this]() { Run(); });
+  } catch (const std::exception& exception) {
+    // Executor has rejected the task, so the error is the result.
+    auto self = std::move(self_);
+    exception_ = std::current_exception();
+    SetReady();
+  }
+}
+
+template<typename ResultType>
+void FunctionExecutor<ResultType>::Run() {
+  auto self = std::move(self_);
+  try {
+    Invoke(&result_);
+  } catch (const std::exception& exception) {
+    exception_ = std::current_exception();
+  }
+  SetReady();
+}
+
+template<typename ResultType>
+void FunctionExecutor<ResultType>::Subscribe(std::function<void()> callback) {
+  has_subscribers_.store(true);
+
+  auto* node = new Callback{std::move(callback), callbacks_.load()};
+  while (node->next != Closed()) {
+    if (callbacks_.compare_exchange_weak(node->next, node)) {
+      return;
     }
-    is_result_ready_ = true;
+  }
 
-    unique_lock.unlock();
-    cv_.notify_one();
-  });
+  // Callbacks were already started, so this one is late.
+  node->function();
+  delete node;
 }
 
 template<typename ResultType>
-ResultType FunctionExecutor<ResultType>::Wait() {
-  std::unique_lock<std::mutex> unique_lock(result_mutex_);
-  cv_.wait(unique_lock, [this]() { return is_result_ready_; });
+bool FunctionExecutor<ResultType>::HasSubscribers() const {
+  return has_subscribers_.load();
+}
 
-  if (exception_ != nullptr) {
-    std::rethrow_exception(exception_);
+template<typename ResultType>
+bool FunctionExecutor<ResultType>::IsReady() const {
+  return state_.load() == kReady;
+}
+
+template<typename ResultType>
+void FunctionExecutor<ResultType>::SetReady() {
+  // Waiter increments parked_count_ before it checks state_ in the
+  // kernel, so either it sees kReady or this thread sees the waiter.
+  state_.store(kReady);
+  if (parked_count_.load() > 0) {
+    FutexWakeAll(&state_);
+  }
+
+  // Stack is reversed, so that callbacks start in the subscription order.
+  Callback* callback = callbacks_.exchange(Closed());
+  Callback* reversed = nullptr;
+  while (callback != nullptr) {
+    reversed = std::exchange(callback, std::exchange(callback->next,
+                                                     reversed));
+  }
+  while (reversed != nullptr) {
+    reversed->function();
+    delete std::exchange(reversed, reversed->next);
   }
-  return *result_;
 }
 
-template<>
-void FunctionExecutor<void>::Wait() {
-  std::unique_lock<std::mutex> unique_lock(result_mutex_);
-  cv_.wait(unique_lock, [this]() { return is_result_ready_; });
+template<typename ResultType>
+typename FunctionExecutor<ResultType>::Callback*
+FunctionExecutor<ResultType>::Closed() {
+  static Callback closed{};
+  return &closed;
+}
+
+template<typename ResultType>
+void FunctionExecutor<ResultType>::WaitForResult() {
+  for (int spin = 0; spin < kSpinCount; spin++) {
+    if (IsReady()) {
+      return;
+    }
+    CpuRelax();
+  }
 
+  // Inside a task, the function may be queued behind the tasks of other
+  // blocked workers, so the worker runs pending tasks instead of sleeping.
+  // Submit doesn't wake it, so it only naps when the pool is empty.
+  if (ThreadPool::IsWorkerThread()) {
+    while (!IsReady()) {
+      if (!ThreadPool::RunPendingTask()) {
+        parked_count_.fetch_add(1);
+        FutexWaitFor(&state_, kPending, kHelpInterval);
+        parked_count_.fetch_sub(1);
+      }
+    }
+    return;
+  }
+
+  parked_count_.fetch_add(1);
+  while (!IsReady()) {
+    FutexWait(&state_, kPending);
+  }
+  parked_count_.fetch_sub(1);
+}
+
+template<typename ResultType>
+bool FunctionExecutor<ResultType>::WaitForResultFor(
+    std::chrono::nanoseconds timeout) {
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  for (int spin = 0; spin < kSpinCount; spin++) {
+    if (IsReady()) {
+      return true;
+    }
+    CpuRelax();
+  }
+
+  parked_count_.fetch_add(1);
+  while (!IsReady()) {
+    auto remaining = deadline - std::chrono::steady_clock::now();
+    if (remaining <= std::chrono::nanoseconds::zero()) {
+      break;
+    }
+    FutexWaitFor(&state_, kPending, remaining);
+  }
+  parked_count_.fetch_sub(1);
+  return IsReady();
+}
+
+template<typename ResultType>
+void FunctionExecutor<ResultType>::RethrowException() const {
   if (exception_ != nullptr) {
     std::rethrow_exception(exception_);
   }
 }
 
 template<typename ResultType>
-FunctionExecutor<ResultType>::~FunctionExecutor() {
-  if (thread_.joinable()) {
-    thread_.join();
+typename FunctionExecutor<ResultType>::WaitResult
+FunctionExecutor<ResultType>::Wait() {
+  WaitForResult();
+  RethrowException();
+  if constexpr (!std::is_void_v<ResultType>) {
+    return *result_.value;
+  }
+}
+
+template<typename ResultType>
+ResultType FunctionExecutor<ResultType>::Take() {
+  WaitForResult();
+  RethrowException();
+  if constexpr (!std::is_void_v<ResultType>) {
+    return std::move(*result_.value);
   }
 }
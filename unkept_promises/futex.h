@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <ctime>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// std::atomic::wait appeared only in C++20, so threads are parked
+// with the futex syscall directly.
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t));
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+// Blocks while value equals expected. May return spuriously.
+inline void FutexWait(std::atomic<uint32_t>* value, uint32_t expected) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(value), FUTEX_WAIT_PRIVATE,
+          expected, nullptr, nullptr, 0);
+}
+
+// Same, but for at most timeout.
+inline void FutexWaitFor(std::atomic<uint32_t>* value, uint32_t expected,
+                         std::chrono::nanoseconds timeout) {
+  timespec relative{};
+  relative.tv_sec = timeout.count() / 1'000'000'000;
+  relative.tv_nsec = timeout.count() % 1'000'000'000;
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(value), FUTEX_WAIT_PRIVATE,
+          expected, &relative, nullptr, 0);
+}
+
+inline void FutexWakeAll(std::atomic<uint32_t>* value) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(value), FUTEX_WAKE_PRIVATE,
+          INT_MAX, nullptr, nullptr, 0);
+}
+
+// Hint to the core, that the thread is spinning.
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
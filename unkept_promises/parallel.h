@@ -0,0 +1,182 @@
+#pragma once
+
+#include "promise.h"
+#include "when.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Fork-join algorithms over index ranges [begin; end). The caller submits
+// a single task, which splits its range in halves: the right half is
+// submitted as a new task and the left one is split further, down to
+// grain_size indices, which the task processes itself. Pieces are joined
+// by WhenAll in the index order. So nothing waits in a thread, the tree
+// of promises is built by the pool, not by the caller, and nested calls
+// from the tasks of a pool just add tasks to it instead of starting more
+// threads. With zero grain_size the range is split into a few pieces per
+// thread of the default pool.
+
+inline int64_t GetGrainSize(int64_t begin, int64_t end, int64_t grain_size) {
+  if (grain_size > 0) {
+    return grain_size;
+  }
+  const int64_t kPiecesPerThread = 4;
+  int64_t pieces = kPiecesPerThread * ThreadPool::GetDefaultThreadCount();
+  return std::max<int64_t>(1, (end - begin + pieces - 1) / pieces);
+}
+
+// Runs the piece, which the splitting task keeps, and the forwarding of
+// the ready results, both of which never block.
+inline const std::shared_ptr<Executor>& GetInlineExecutor() {
+  static auto* executor =
+      new std::shared_ptr<Executor>(std::make_shared<InlineExecutor>());
+  return *executor;
+}
+
+// Promise of the promise, which split returns in a task of executor. Task
+// doesn't wait for that promise: its result is forwarded, once ready.
+template<typename ResultType, typename Split>
+std::shared_ptr<Promise<ResultType>> SpawnPiece(
+    Split split, const std::shared_ptr<Executor>& executor) {
+  auto joined =
+      MakeFunctionTask<std::shared_ptr<Promise<ResultType>>>(std::move(split));
+  auto result = MakeFunctionTask<ResultType>([joined]() {
+    return std::move(*joined->Take()).Wait();
+  });
+
+  joined->Subscribe([joined, result]() {
+    Executor* executor = GetInlineExecutor().get();
+    std::shared_ptr<FunctionExecutor<ResultType>> state;
+    try {
+      state = joined->Wait()->GetFunctionExecutor();
+    } catch (...) {
+      // Split threw or was rejected, result rethrows the same exception.
+      result->Execute(executor);
+      return;
+    }
+    state->Subscribe([result, executor]() {
+      result->Execute(executor);
+    });
+  });
+  joined->Execute(executor.get());
+  return std::make_shared<Promise<ResultType>>(result, executor);
+}
+
+// Spawns the right halves of the range by spawn(begin, end) and runs
+// the rest by run(begin, end) in the current task. Promises of the pieces
+// are in the index order.
+template<typename ResultType, typename Run, typename Spawn>
+std::vector<std::shared_ptr<Promise<ResultType>>> SplitPieces(
+    int64_t begin, int64_t end, int64_t grain_size, const Run& run,
+    const Spawn& spawn) {
+  std::vector<std::shared_ptr<Promise<ResultType>>> pieces;
+  while (end - begin > grain_size) {
+    int64_t middle = begin + (end - begin) / 2;
+    pieces.push_back(spawn(middle, end));
+    end = middle;
+  }
+  pieces.push_back(MakePromise([&run, begin, end]() {
+    return run(begin, end);
+  }, GetInlineExecutor()));
+  std::reverse(pieces.begin(), pieces.end());
+  return pieces;
+}
+
+template<typename Function>
+std::shared_ptr<Promise<void>> ParallelForPieces(
+    int64_t begin, int64_t end, int64_t grain_size, const Function& function,
+    const std::shared_ptr<Executor>& executor) {
+  auto run = [&function](int64_t first, int64_t last) {
+    for (int64_t index = first; index < last; index++) {
+      function(index);
+    }
+  };
+  auto spawn = [grain_size, &function, &executor](int64_t first,
+                                                  int64_t last) {
+    return SpawnPiece<void>([first, last, grain_size, function, executor]() {
+      return ParallelForPieces(first, last, grain_size, function, executor);
+    }, executor);
+  };
+  return WhenAll(SplitPieces<void>(begin, end, grain_size, run, spawn),
+                 executor);
+}
+
+// Calls function(index) for each index of the range.
+template<typename Function>
+std::shared_ptr<Promise<void>> ParallelFor(
+    int64_t begin, int64_t end, Function function,
+    std::shared_ptr<Executor> executor = GetDefaultExecutor(),
+    int64_t grain_size = 0) {
+  grain_size = GetGrainSize(begin, end, grain_size);
+  return SpawnPiece<void>([begin, end, grain_size, function, executor]() {
+    return ParallelForPieces(begin, end, grain_size, function, executor);
+  }, executor);
+}
+
+// Vector of function(index) for the indices of the range. Pieces write
+// their results right into it, so the results must be default
+// constructible, but aren't copied while joined.
+template<typename Function>
+auto ParallelTransform(
+    int64_t begin, int64_t end, Function function,
+    std::shared_ptr<Executor> executor = GetDefaultExecutor(),
+    int64_t grain_size = 0) {
+  using ResultType = std::result_of_t<Function&(int64_t)>;
+  auto results = std::make_shared<std::vector<ResultType>>(
+      std::max<int64_t>(0, end - begin));
+
+  return ParallelFor(begin, end, [begin, function, results](int64_t index) {
+    (*results)[index - begin] = function(index);
+  }, std::move(executor), grain_size)->Then([results]() {
+    return std::move(*results);
+  });
+}
+
+template<typename ResultType, typename Map, typename Reduce>
+std::shared_ptr<Promise<ResultType>> ParallelReducePieces(
+    int64_t begin, int64_t end, int64_t grain_size, const ResultType& identity,
+    const Map& map, const Reduce& reduce,
+    const std::shared_ptr<Executor>& executor) {
+  auto run = [&identity, &map, &reduce](int64_t first, int64_t last) {
+    ResultType result = identity;
+    for (int64_t index = first; index < last; index++) {
+      result = reduce(result, map(index));
+    }
+    return result;
+  };
+  auto spawn = [grain_size, &identity, &map, &reduce, &executor](
+                   int64_t first, int64_t last) {
+    return SpawnPiece<ResultType>(
+        [first, last, grain_size, identity, map, reduce, executor]() {
+          return ParallelReducePieces(first, last, grain_size, identity, map,
+                                      reduce, executor);
+        }, executor);
+  };
+  return WhenAll(SplitPieces<ResultType>(begin, end, grain_size, run, spawn),
+                 executor)
+      ->Then([reduce](const std::vector<ResultType>& pieces) {
+        ResultType result = pieces[0];
+        for (size_t index = 1; index < pieces.size(); index++) {
+          result = reduce(result, pieces[index]);
+        }
+        return result;
+      });
+}
+
+// reduce(...reduce(reduce(identity, map(begin)), map(begin + 1))...).
+// Reduce must be associative, as the pieces are reduced in a tree, and
+// identity is used as the start of each piece.
+template<typename ResultType, typename Map, typename Reduce>
+std::shared_ptr<Promise<ResultType>> ParallelReduce(
+    int64_t begin, int64_t end, ResultType identity, Map map, Reduce reduce,
+    std::shared_ptr<Executor> executor = GetDefaultExecutor(),
+    int64_t grain_size = 0) {
+  grain_size = GetGrainSize(begin, end, grain_size);
+  return SpawnPiece<ResultType>(
+      [begin, end, grain_size, identity, map, reduce, executor]() {
+        return ParallelReducePieces(begin, end, grain_size, identity, map,
+                                    reduce, executor);
+      }, executor);
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+#include "executor.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+enum class Priority {
+  kHigh = 0,
+  kNormal = 1,
+  kLow = 2,
+};
+
+// What Submit does, when the queue is full.
+enum class OverflowPolicy {
+  // Waits until a worker takes a task from the queue.
+  kBlock,
+  // Throws RejectedError, promises rethrow it from Wait.
+  kReject,
+  // Runs the task in the submitting thread.
+  kRunInCaller,
+};
+
+class RejectedError : public std::runtime_error {
+ public:
+  RejectedError() : std::runtime_error("executor queue is full") {
+  }
+};
+
+struct PriorityExecutorStats {
+  size_t queue_size = 0;
+  size_t max_queue_size = 0;
+  int64_t submitted_count = 0;
+  int64_t rejected_count = 0;
+  int64_t run_in_caller_count = 0;
+  int64_t completed_count = 0;
+  // Time from Submit to the start of the task, over the started tasks.
+  double total_wait_seconds = 0;
+  double max_wait_seconds = 0;
+};
+
+// Executor with a fixed number of workers and a bounded queue, in which
+// tasks of higher priority are taken first. Submit of Executor uses the
+// normal priority, GetExecutor gives executors of the other ones for
+// promises. Tasks, which are submitted by the workers themselves, like
+// continuations, bypass the bound, otherwise a full queue could block
+// all the workers. Must be created by std::make_shared and mustn't be
+// destroyed by its own tasks. Unlike ThreadPool, blocked tasks don't run
+// other ones, so they mustn't wait for the tasks of the same executor.
+class PriorityExecutor
+    : public Executor,
+      public std::enable_shared_from_this<PriorityExecutor> {
+ public:
+  PriorityExecutor(size_t max_concurrency, size_t max_queue_size,
+                   OverflowPolicy overflow_policy = OverflowPolicy::kBlock);
+  ~PriorityExecutor() override;
+
+  PriorityExecutor(const PriorityExecutor&) = delete;
+  PriorityExecutor& operator=(const PriorityExecutor&) = delete;
+
+  void Submit(std::function<void()> task) override;
+  void Submit(std::function<void()> task, Priority priority);
+
+  // Shares the ownership of this executor.
+  std::shared_ptr<Executor> GetExecutor(Priority priority);
+
+  PriorityExecutorStats GetStats() const;
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  static const size_t kPriorityCount = 3;
+
+  struct Task {
+    std::function<void()> function;
+    Clock::time_point submitted;
+  };
+
+  // Submits with the fixed priority.
+  class PriorityView : public Executor {
+   public:
+    void Submit(std::function<void()> task) override {
+      executor->Submit(std::move(task), priority);
+    }
+
+    PriorityExecutor* executor = nullptr;
+    Priority priority = Priority::kNormal;
+  };
+
+ private:
+  void Run();
+  size_t GetQueueSize() const;
+
+ private:
+  static inline thread_local PriorityExecutor* current_executor_ = nullptr;
+
+  const size_t max_queue_size_;
+  const OverflowPolicy overflow_policy_;
+  std::array<PriorityView, kPriorityCount> views_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable not_empty_cv_;
+  std::condition_variable not_full_cv_;
+  std::array<std::deque<Task>, kPriorityCount> queues_;
+  bool is_stopped_ = false;
+  PriorityExecutorStats stats_;
+
+  std::vector<std::thread> threads_;
+};
+
+inline PriorityExecutor::PriorityExecutor(size_t max_concurrency,
+                                          size_t max_queue_size,
+                                          OverflowPolicy overflow_policy)
+    : max_queue_size_(std::max<size_t>(max_queue_size, 1)),
+      overflow_policy_(overflow_policy) {
+  for (size_t priority = 0; priority < kPriorityCount; priority++) {
+    views_[priority].executor = this;
+    views_[priority].priority = static_cast<Priority>(priority);
+  }
+
+  max_concurrency = std::max<size_t>(max_concurrency, 1);
+  threads_.reserve(max_concurrency);
+  for (size_t index = 0; index < max_concurrency; index++) {
+    threads_.emplace_back([this] { Run(); });
+  }
+}
+
+inline PriorityExecutor::~PriorityExecutor() {
+  {
+    std::lock_guard lock_guard(mutex_);
+    is_stopped_ = true;
+  }
+  not_empty_cv_.notify_all();
+
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+inline void PriorityExecutor::Submit(std::function<void()> task) {
+  Submit(std::move(task), Priority::kNormal);
+}
+
+inline void PriorityExecutor::Submit(std::function<void()> task,
+                                     Priority priority) {
+  std::unique_lock unique_lock(mutex_);
+  if (current_executor_ != this && GetQueueSize() >= max_queue_size_) {
+    switch (overflow_policy_) {
+      case OverflowPolicy::kBlock:
+        not_full_cv_.wait(unique_lock, [this] {
+          return GetQueueSize() < max_queue_size_;
+        });
+        break;
+      case OverflowPolicy::kReject:
+        stats_.rejected_count++;
+        throw RejectedError();
+      case OverflowPolicy::kRunInCaller:
+        stats_.run_in_caller_count++;
+        unique_lock.unlock();
+        task();
+        return;
+    }
+  }
+
+  queues_[static_cast<size_t>(priority)].push_back(
+      {std::move(task), Clock::now()});
+  stats_.submitted_count++;
+  stats_.max_queue_size = std::max(stats_.max_queue_size, GetQueueSize());
+  unique_lock.unlock();
+  not_empty_cv_.notify_one();
+}
+
+inline std::shared_ptr<Executor> PriorityExecutor::GetExecutor(
+    Priority priority) {
+  return std::shared_ptr<Executor>(shared_from_this(),
+                                   &views_[static_cast<size_t>(priority)]);
+}
+
+inline PriorityExecutorStats PriorityExecutor::GetStats() const {
+  std::lock_guard lock_guard(mutex_);
+  PriorityExecutorStats stats = stats_;
+  stats.queue_size = GetQueueSize();
+  return stats;
+}
+
+inline size_t PriorityExecutor::GetQueueSize() const {
+  size_t size = 0;
+  for (const auto& queue : queues_) {
+    size += queue.size();
+  }
+  return size;
+}
+
+inline void PriorityExecutor::Run() {
+  current_executor_ = this;
+
+  while (true) {
+    Task task;
+    {
+      std::unique_lock unique_lock(mutex_);
+      not_empty_cv_.wait(unique_lock, [this] {
+        return GetQueueSize() > 0 || is_stopped_;
+      });
+      if (GetQueueSize() == 0) {
+        return;
+      }
+
+      auto queue = std::find_if(queues_.begin(), queues_.end(),
+                                [](const auto& queue) {
+                                  return !queue.empty();
+                                });
+      task = std::move(queue->front());
+      queue->pop_front();
+
+      double wait_seconds = std::chrono::duration<double>(
+          Clock::now() - task.submitted).count();
+      stats_.total_wait_seconds += wait_seconds;
+      stats_.max_wait_seconds = std::max(stats_.max_wait_seconds,
+                                         wait_seconds);
+    }
+    not_full_cv_.notify_one();
+
+    task.function();
+    task.function = nullptr;
+
+    std::lock_guard lock_guard(mutex_);
+    stats_.completed_count++;
+  }
+}
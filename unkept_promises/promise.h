@@ -3,8 +3,10 @@
 #define PROMISE_SUPPORTS_EXCEPTIONS
 #define PROMISE_SUPPORTS_THEN
 
+#include "cancellation.h"
 #include "function_executor.h"
 
+#include <chrono>
 #include <condition_variable>
 #include <memory>
 #include <thread>
@@ -12,26 +14,74 @@
 template<typename ResultType>
 class Promise : public std::enable_shared_from_this<Promise<ResultType>> {
  public:
-  explicit Promise(std::function<ResultType()> function);
+  // Function isn't started, if token is cancelled before that.
+  explicit Promise(
+      std::function<ResultType()> function,
+      std::shared_ptr<Executor> executor = GetDefaultExecutor(),
+      CancellationToken token = CancellationToken());
+  // Promise of the state, whose function is started by someone else.
+  Promise(std::shared_ptr<FunctionExecutor<ResultType>> function_executor,
+          std::shared_ptr<Executor> executor,
+          CancellationToken token = CancellationToken());
+  // Function may refer to the locals of the caller, so the last promise
+  // of a chain waits for it. Promises with continuations don't wait.
+  ~Promise();
 
-  ResultType Wait();
+  // Copies of the promise share the result, so it isn't copied on Wait.
+  const ResultType& Wait() const&;
+  ResultType Wait() &&;
+  // Moves the result out, the copies of this promise and its
+  // continuations see the moved-from value after that.
+  ResultType Take();
 
+  // Return whether the result is ready, exceptions are thrown only by Wait.
+  template<typename Rep, typename Period>
+  bool WaitFor(const std::chrono::duration<Rep, Period>& timeout) const;
+  template<typename Clock, typename Duration>
+  bool WaitUntil(
+      const std::chrono::time_point<Clock, Duration>& deadline) const;
+
+  // Function gets the result by const reference, so it mustn't take
+  // move-only types by value. Continuations share the token of the
+  // promise: once it is cancelled, Then functions aren't started and
+  // throw CancelledError instead, which Catch handlers get.
   template<typename Function>
   auto Then(Function function);
 
   template<typename HandlerType>
   std::shared_ptr<Promise<ResultType>> Catch(HandlerType handler);
 
+  // Combinators like WhenAll subscribe to the state directly.
+  const std::shared_ptr<FunctionExecutor<ResultType>>&
+  GetFunctionExecutor() const;
+  const std::shared_ptr<Executor>& GetExecutor() const;
+  const CancellationToken& GetToken() const;
+
  private:
+  // Then and Catch continuations run on the same executor.
+  std::shared_ptr<Executor> executor_;
+  CancellationToken token_;
   std::shared_ptr<FunctionExecutor<ResultType>> function_executor_;
 };
 
 template<>
 class Promise<void> : public std::enable_shared_from_this<Promise<void>> {
  public:
-  explicit Promise(std::function<void()> function);
+  explicit Promise(std::function<void()> function,
+                   std::shared_ptr<Executor> executor = GetDefaultExecutor(),
+                   CancellationToken token = CancellationToken());
+  Promise(std::shared_ptr<FunctionExecutor<void>> function_executor,
+          std::shared_ptr<Executor> executor,
+          CancellationToken token = CancellationToken());
+  ~Promise();
 
-  void Wait();
+  void Wait() const;
+
+  template<typename Rep, typename Period>
+  bool WaitFor(const std::chrono::duration<Rep, Period>& timeout) const;
+  template<typename Clock, typename Duration>
+  bool WaitUntil(
+      const std::chrono::time_point<Clock, Duration>& deadline) const;
 
   template<typename Function>
   auto Then(Function function);
@@ -39,75 +89,227 @@ class Promise<void> : public std::enable_shared_from_this<Promise<void>> {
   template<typename HandlerType>
   std::shared_ptr<Promise<void>> Catch(HandlerType handler);
 
+  const std::shared_ptr<FunctionExecutor<void>>& GetFunctionExecutor() const;
+  const std::shared_ptr<Executor>& GetExecutor() const;
+  const CancellationToken& GetToken() const;
+
  private:
+  std::shared_ptr<Executor> executor_;
+  CancellationToken token_;
   std::shared_ptr<FunctionExecutor<void>> function_executor_;
 };
 
+// Function is stored in the shared state as is, without std::function.
 template<typename Function>
-auto MakePromise(Function function) {
-  return std::make_shared<Promise<std::result_of_t<Function&()>>>(function);
+auto MakePromise(Function function,
+                 std::shared_ptr<Executor> executor = GetDefaultExecutor(),
+                 CancellationToken token = CancellationToken()) {
+  using ResultType = std::result_of_t<Function&()>;
+  auto function_executor = MakeFunctionTask<ResultType>(
+      [function = std::move(function), token]() mutable {
+        token.ThrowIfCancelled();
+        return function();
+      });
+  function_executor->Execute(executor.get());
+  return std::make_shared<Promise<ResultType>>(std::move(function_executor),
+                                               std::move(executor),
+                                               std::move(token));
+}
+
+// Promise of function, which is submitted to executor only when previous
+// is ready, so no thread is blocked while the chain is running.
+template<typename ResultType, typename PreviousType, typename Function>
+std::shared_ptr<Promise<ResultType>> MakeContinuation(
+    const std::shared_ptr<FunctionExecutor<PreviousType>>& previous,
+    Function function, const std::shared_ptr<Executor>& executor,
+    const CancellationToken& token) {
+  auto next = MakeFunctionTask<ResultType>(std::move(function));
+  previous->Subscribe([next, executor]() {
+    next->Execute(executor.get());
+  });
+  return std::make_shared<Promise<ResultType>>(next, executor, token);
+}
+
+template<typename ResultType>
+Promise<ResultType>::Promise(std::function<ResultType()> function,
+                             std::shared_ptr<Executor> executor,
+                             CancellationToken token)
+    : executor_(std::move(executor)),
+      token_(std::move(token)),
+      function_executor_(MakeFunctionTask<ResultType>(
+          [function = std::move(function), token = token_]() {
+            token.ThrowIfCancelled();
+            return function();
+          })) {
+  function_executor_->Execute(executor_.get());
+}
+
+inline Promise<void>::Promise(std::function<void()> function,
+                              std::shared_ptr<Executor> executor,
+                              CancellationToken token)
+    : executor_(std::move(executor)),
+      token_(std::move(token)),
+      function_executor_(MakeFunctionTask<void>(
+          [function = std::move(function), token = token_]() {
+            token.ThrowIfCancelled();
+            function();
+          })) {
+  function_executor_->Execute(executor_.get());
+}
+
+template<typename ResultType>
+Promise<ResultType>::Promise(
+    std::shared_ptr<FunctionExecutor<ResultType>> function_executor,
+    std::shared_ptr<Executor> executor, CancellationToken token)
+    : executor_(std::move(executor)),
+      token_(std::move(token)),
+      function_executor_(std::move(function_executor)) {
+}
+
+inline Promise<void>::Promise(
+    std::shared_ptr<FunctionExecutor<void>> function_executor,
+    std::shared_ptr<Executor> executor, CancellationToken token)
+    : executor_(std::move(executor)),
+      token_(std::move(token)),
+      function_executor_(std::move(function_executor)) {
 }
 
 template<typename ResultType>
-Promise<ResultType>::Promise(std::function<ResultType()> function)
-    : function_executor_(std::make_shared<FunctionExecutor<ResultType>>()) {
-  function_executor_->Execute(function);
+Promise<ResultType>::~Promise() {
+  if (!function_executor_->HasSubscribers()) {
+    function_executor_->WaitForResult();
+  }
 }
 
-Promise<void>::Promise(std::function<void()> function)
-    : function_executor_(std::make_shared<FunctionExecutor<void>>()) {
-  function_executor_->Execute(function);
+inline Promise<void>::~Promise() {
+  if (!function_executor_->HasSubscribers()) {
+    function_executor_->WaitForResult();
+  }
 }
 
 template<typename ResultType>
-ResultType Promise<ResultType>::Wait() {
+const ResultType& Promise<ResultType>::Wait() const& {
   return function_executor_->Wait();
 }
 
-void Promise<void>::Wait() {
+template<typename ResultType>
+ResultType Promise<ResultType>::Wait() && {
+  return function_executor_->Take();
+}
+
+template<typename ResultType>
+ResultType Promise<ResultType>::Take() {
+  return function_executor_->Take();
+}
+
+inline void Promise<void>::Wait() const {
   function_executor_->Wait();
 }
 
+template<typename ResultType>
+template<typename Rep, typename Period>
+bool Promise<ResultType>::WaitFor(
+    const std::chrono::duration<Rep, Period>& timeout) const {
+  return function_executor_->WaitForResultFor(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(timeout));
+}
+
+template<typename Rep, typename Period>
+bool Promise<void>::WaitFor(
+    const std::chrono::duration<Rep, Period>& timeout) const {
+  return function_executor_->WaitForResultFor(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(timeout));
+}
+
+template<typename ResultType>
+template<typename Clock, typename Duration>
+bool Promise<ResultType>::WaitUntil(
+    const std::chrono::time_point<Clock, Duration>& deadline) const {
+  return WaitFor(deadline - Clock::now());
+}
+
+template<typename Clock, typename Duration>
+bool Promise<void>::WaitUntil(
+    const std::chrono::time_point<Clock, Duration>& deadline) const {
+  return WaitFor(deadline - Clock::now());
+}
+
+template<typename ResultType>
+const std::shared_ptr<FunctionExecutor<ResultType>>&
+Promise<ResultType>::GetFunctionExecutor() const {
+  return function_executor_;
+}
+
+inline const std::shared_ptr<FunctionExecutor<void>>&
+Promise<void>::GetFunctionExecutor() const {
+  return function_executor_;
+}
+
+template<typename ResultType>
+const std::shared_ptr<Executor>& Promise<ResultType>::GetExecutor() const {
+  return executor_;
+}
+
+inline const std::shared_ptr<Executor>& Promise<void>::GetExecutor() const {
+  return executor_;
+}
+
+template<typename ResultType>
+const CancellationToken& Promise<ResultType>::GetToken() const {
+  return token_;
+}
+
+inline const CancellationToken& Promise<void>::GetToken() const {
+  return token_;
+}
+
 template<typename ResultType>
 template<typename Function>
 auto Promise<ResultType>::Then(Function function) {
-  auto promise = this->shared_from_this();
-  return MakePromise([promise, function]() {
-    return function(promise->Wait());
-  });
+  using NewResult = std::result_of_t<Function&(const ResultType&)>;
+  auto previous = function_executor_;
+  return MakeContinuation<NewResult>(
+      previous, [previous, function, token = token_]() {
+        token.ThrowIfCancelled();
+        return function(previous->Wait());
+      }, executor_, token_);
 }
 
 template<typename Function>
 auto Promise<void>::Then(Function function) {
-  auto promise = this->shared_from_this();
-  return MakePromise([promise, function]() {
-    promise->Wait();
-    return function();
-  });
+  using NewResult = std::result_of_t<Function&()>;
+  auto previous = function_executor_;
+  return MakeContinuation<NewResult>(
+      previous, [previous, function, token = token_]() {
+        token.ThrowIfCancelled();
+        previous->Wait();
+        return function();
+      }, executor_, token_);
 }
 
 template<typename ResultType>
 template<typename HandlerType>
 std::shared_ptr<Promise<ResultType>>
 Promise<ResultType>::Catch(HandlerType handler) {
-  auto promise = this->shared_from_this();
-  return MakePromise([promise, handler]() -> ResultType {
-    try {
-      return promise->Wait();
-    } catch (const std::exception& e) {
-      return handler(e);
-    }
-  });
+  auto previous = function_executor_;
+  return MakeContinuation<ResultType>(
+      previous, [previous, handler]() -> ResultType {
+        try {
+          return previous->Wait();
+        } catch (const std::exception& e) {
+          return handler(e);
+        }
+      }, executor_, token_);
 }
 
 template<typename HandlerType>
 std::shared_ptr<Promise<void>> Promise<void>::Catch(HandlerType handler) {
-  auto promise = this->shared_from_this();
-  return MakePromise([promise, handler]() -> void {
+  auto previous = function_executor_;
+  return MakeContinuation<void>(previous, [previous, handler]() {
     try {
-      promise->Wait();
+      previous->Wait();
     } catch (const std::exception& e) {
       handler(e);
     }
-  });
+  }, executor_, token_);
 }
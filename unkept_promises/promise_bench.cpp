@@ -0,0 +1,517 @@
+#include "benchmark/benchmark.h"
+
+#include "async_io.h"
+#include "channel.h"
+#include "parallel.h"
+#include "promise.h"
+#include "promise_coroutine.h"
+#include "task_graph.h"
+#include "timeout.h"
+#include "when.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <numeric>
+#include <random>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+// Counts heap allocations of the whole process, benchmarks report
+// the difference over their loops.
+std::atomic<int64_t> allocation_count(0);
+std::atomic<int64_t> allocated_bytes(0);
+
+// All replaced operators go through these two, so that memory from
+// malloc is always freed by free, aligned or not.
+static void* CountedAllocate(size_t size, size_t alignment) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  void* pointer = nullptr;
+  if (alignment <= alignof(std::max_align_t)) {
+    pointer = std::malloc(size == 0 ? 1 : size);
+  } else if (posix_memalign(&pointer, alignment, size == 0 ? 1 : size) != 0) {
+    pointer = nullptr;
+  }
+  if (pointer == nullptr) {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+static void CountedFree(void* pointer) {
+  std::free(pointer);
+}
+
+void* operator new(size_t size) {
+  return CountedAllocate(size, alignof(std::max_align_t));
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+  return CountedAllocate(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* pointer) noexcept {
+  CountedFree(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+  CountedFree(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept {
+  CountedFree(pointer);
+}
+
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept {
+  CountedFree(pointer);
+}
+
+// Reports allocations, made since the construction, per promise.
+class AllocationCounter {
+ public:
+  explicit AllocationCounter(benchmark::State* state)
+      : state_(state), start_count_(allocation_count.load()),
+        start_bytes_(allocated_bytes.load()) {
+  }
+
+  void Report(int64_t promise_count) {
+    double promises = std::max<int64_t>(promise_count, 1);
+    state_->counters["allocations_per_promise"] =
+        (allocation_count.load() - start_count_) / promises;
+    state_->counters["bytes_per_promise"] =
+        (allocated_bytes.load() - start_bytes_) / promises;
+  }
+
+ private:
+  benchmark::State* state_;
+  int64_t start_count_;
+  int64_t start_bytes_;
+};
+
+// Creation of a promise of int and Wait for it.
+static void BM_CreateAndWait(benchmark::State& state) {
+  std::shared_ptr<Executor> pool = std::make_shared<ThreadPool>(1);
+
+  AllocationCounter allocations(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(MakePromise([] { return 42; }, pool)->Wait());
+  }
+  allocations.Report(state.iterations());
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CreateAndWait);
+
+// Time from the moment function returns its result to the moment Wait
+// returns it in another thread. Argument is the delay before the result,
+// in microseconds: with no delay the waiter catches the result while
+// spinning, with a long one it has to be woken up by futex.
+static void BM_WakeupLatency(benchmark::State& state) {
+  std::shared_ptr<Executor> pool = std::make_shared<ThreadPool>(1);
+  auto delay = std::chrono::microseconds(state.range(0));
+
+  for (auto _ : state) {
+    auto promise = MakePromise([delay] {
+      auto start = Clock::now();
+      while (Clock::now() - start < delay) {
+      }
+      return Clock::now();
+    }, pool);
+    auto fulfilled = promise->Wait();
+    state.SetIterationTime(
+        std::chrono::duration<double>(Clock::now() - fulfilled).count());
+  }
+}
+BENCHMARK(BM_WakeupLatency)->UseManualTime()->Unit(benchmark::kMicrosecond)
+    ->Arg(0)->Arg(10)->Arg(1000);
+
+// Threads wait for the same promise, which is fulfilled once all of them
+// have called Wait. Argument is the number of the waiting threads.
+static void BM_ContendedWait(benchmark::State& state) {
+  std::shared_ptr<Executor> pool = std::make_shared<ThreadPool>(1);
+  int thread_count = state.range(0);
+
+  std::mutex promise_mutex;
+  std::shared_ptr<Promise<int>> promise;
+  std::atomic<int64_t> round(0);
+  std::atomic<int> waiting_count(0);
+  std::atomic<int> done_count(0);
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < thread_count; i++) {
+    threads.emplace_back([&] {
+      // Negative round stops the thread.
+      for (int64_t seen = 0; ; ) {
+        while (round.load() == seen) {
+          std::this_thread::yield();
+        }
+        seen = round.load();
+        if (seen < 0) {
+          return;
+        }
+
+        std::shared_ptr<Promise<int>> current;
+        {
+          std::lock_guard lock_guard(promise_mutex);
+          current = promise;
+        }
+        waiting_count.fetch_add(1);
+        benchmark::DoNotOptimize(current->Wait());
+        done_count.fetch_add(1);
+      }
+    });
+  }
+
+  for (auto _ : state) {
+    std::atomic<bool> is_released(false);
+    {
+      std::lock_guard lock_guard(promise_mutex);
+      promise = MakePromise([&is_released] {
+        while (!is_released.load()) {
+          std::this_thread::yield();
+        }
+        return 42;
+      }, pool);
+    }
+    waiting_count.store(0);
+    done_count.store(0);
+    round.fetch_add(1);
+
+    while (waiting_count.load() < thread_count) {
+      std::this_thread::yield();
+    }
+    is_released.store(true);
+    while (done_count.load() < thread_count) {
+      std::this_thread::yield();
+    }
+  }
+
+  round.store(-1);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  state.SetItemsProcessed(state.iterations() * thread_count);
+}
+BENCHMARK(BM_ContendedWait)->UseRealTime()->Unit(benchmark::kMicrosecond)
+    ->Arg(1)->Arg(4)->Arg(16);
+
+// Argument is the number of promises, which are joined by WhenAll.
+static void BM_FanOut(benchmark::State& state) {
+  std::shared_ptr<Executor> pool = GetDefaultExecutor();
+
+  AllocationCounter allocations(&state);
+  for (auto _ : state) {
+    std::vector<std::shared_ptr<Promise<int64_t>>> promises;
+    promises.reserve(state.range(0));
+    for (int64_t i = 0; i < state.range(0); i++) {
+      promises.push_back(MakePromise([i] { return i; }, pool));
+    }
+    benchmark::DoNotOptimize(WhenAll(promises, pool)->Wait().size());
+  }
+  allocations.Report(state.iterations() * state.range(0));
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_FanOut)->UseRealTime()->Unit(benchmark::kMicrosecond)
+    ->Arg(10)->Arg(1000)->Arg(100'000);
+
+// Argument: 0 returns the value, 1 throws and the exception is
+// handled by Catch.
+static void BM_CatchException(benchmark::State& state) {
+  std::shared_ptr<Executor> pool = std::make_shared<ThreadPool>(1);
+  bool is_thrown = state.range(0) == 1;
+
+  for (auto _ : state) {
+    auto promise = MakePromise([is_thrown]() -> int {
+      if (is_thrown) {
+        throw std::runtime_error("error");
+      }
+      return 42;
+    }, pool)->Catch([](const std::exception&) { return 0; });
+    benchmark::DoNotOptimize(promise->Wait());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CatchException)->Arg(0)->Arg(1);
+
+// Result of the given number of bytes is moved out with Take.
+static void BM_ResultSize(benchmark::State& state) {
+  std::shared_ptr<Executor> pool = std::make_shared<ThreadPool>(1);
+  size_t size = state.range(0);
+
+  AllocationCounter allocations(&state);
+  for (auto _ : state) {
+    auto result = MakePromise([size] {
+      return std::vector<char>(size);
+    }, pool)->Take();
+    benchmark::DoNotOptimize(result.data());
+  }
+  allocations.Report(state.iterations());
+  state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_ResultSize)->RangeMultiplier(64)->Range(8, 1 << 24);
+
+// Second argument: 0 copies the result out of Wait, 1 only reads it
+// through the reference, 2 moves it out with Take. Building the result
+// costs the same in all the modes.
+static void BM_LargeResult(benchmark::State& state) {
+  std::shared_ptr<Executor> pool = std::make_shared<ThreadPool>(1);
+  size_t size = state.range(0);
+
+  for (auto _ : state) {
+    auto promise = MakePromise([size] {
+      return std::vector<std::string>(size, std::string(32, 'a'));
+    }, pool);
+
+    if (state.range(1) == 0) {
+      std::vector<std::string> result = promise->Wait();
+      benchmark::DoNotOptimize(result.data());
+    } else if (state.range(1) == 1) {
+      benchmark::DoNotOptimize(promise->Wait().size());
+    } else {
+      std::vector<std::string> result = promise->Take();
+      benchmark::DoNotOptimize(result.data());
+    }
+  }
+}
+BENCHMARK(BM_LargeResult)->Unit(benchmark::kMicrosecond)
+    ->ArgsProduct({{1, 1000, 100'000}, {0, 1, 2}});
+
+// Chain of n steps, each one is a Then continuation.
+static void BM_ThenChain(benchmark::State& state) {
+  std::shared_ptr<Executor> pool = std::make_shared<ThreadPool>(1);
+
+  AllocationCounter allocations(&state);
+  for (auto _ : state) {
+    auto promise = MakePromise([] { return int64_t(0); }, pool);
+    for (int64_t i = 0; i < state.range(0); i++) {
+      promise = promise->Then([](int64_t value) { return value + 1; });
+    }
+    benchmark::DoNotOptimize(promise->Wait());
+  }
+  allocations.Report(state.iterations() * (state.range(0) + 1));
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ThenChain)->RangeMultiplier(10)->Range(1, 10'000);
+
+// Sum over 2^22 indices, argument is the grain size, zero picks it by
+// the number of threads.
+static void BM_ParallelReduce(benchmark::State& state) {
+  const int64_t kSize = 1 << 22;
+
+  for (auto _ : state) {
+    auto promise = ParallelReduce(int64_t(0), kSize, int64_t(0),
+                                  [](int64_t index) { return index ^ 1; },
+                                  std::plus<int64_t>(), GetDefaultExecutor(),
+                                  state.range(0));
+    benchmark::DoNotOptimize(promise->Wait());
+  }
+  state.SetItemsProcessed(state.iterations() * kSize);
+}
+BENCHMARK(BM_ParallelReduce)->Unit(benchmark::kMillisecond)->UseRealTime()
+    ->Arg(0)->Arg(1 << 10)->Arg(1 << 14)->Arg(1 << 18);
+
+// Reused graph of empty nodes in layers of 4, each node depends on all
+// the nodes of the previous layer. Argument is the number of layers.
+static void BM_TaskGraphRun(benchmark::State& state) {
+  std::shared_ptr<Executor> pool = std::make_shared<ThreadPool>(1);
+  const int kWidth = 4;
+
+  TaskGraph graph;
+  std::vector<TaskGraph::NodeId> layer;
+  for (int64_t depth = 0; depth < state.range(0); depth++) {
+    std::vector<TaskGraph::NodeId> next_layer;
+    for (int i = 0; i < kWidth; i++) {
+      next_layer.push_back(graph.AddNode("node", [] {}, layer));
+    }
+    layer = std::move(next_layer);
+  }
+
+  AllocationCounter allocations(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(graph.Run(pool)->Wait().seconds);
+  }
+  // Each run is a single promise.
+  allocations.Report(state.iterations());
+  state.SetItemsProcessed(state.iterations() * graph.GetNodeCount());
+}
+BENCHMARK(BM_TaskGraphRun)->Arg(1)->Arg(10)->Arg(100);
+
+// Argument is the number of timers, which are pending at once. Their
+// deadlines are spread over an hour, so the wheel only stores them.
+static void BM_TimerSchedule(benchmark::State& state) {
+  int64_t bytes = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto timer_wheel = std::make_unique<TimerWheel>();
+    auto now = TimerWheel::Clock::now();
+    int64_t start_bytes = allocated_bytes.load();
+    state.ResumeTiming();
+
+    for (int64_t i = 0; i < state.range(0); i++) {
+      auto delay = std::chrono::milliseconds(i * 7919 % 3'600'000);
+      timer_wheel->Schedule(now + delay, [] {});
+    }
+
+    state.PauseTiming();
+    bytes += allocated_bytes.load() - start_bytes;
+    timer_wheel.reset();
+    state.ResumeTiming();
+  }
+  state.counters["bytes_per_timer"] = benchmark::Counter(
+      bytes / double(state.range(0)), benchmark::Counter::kAvgIterations);
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_TimerSchedule)->Unit(benchmark::kMillisecond)
+    ->Arg(1000)->Arg(1'000'000);
+
+// File of the read benchmarks, it is written once, so reads are served
+// by the page cache and the benchmark measures the cost of submission
+// and completion rather than of the disk.
+class BenchFile {
+ public:
+  static const int64_t kSize = 64 << 20;
+
+  static const BenchFile& Get() {
+    static BenchFile file;
+    return file;
+  }
+
+  ~BenchFile() {
+    close(fd_);
+  }
+
+  int GetFd() const {
+    return fd_;
+  }
+
+ private:
+  BenchFile() {
+    char path[] = "/tmp/promise_bench_XXXXXX";
+    fd_ = mkstemp(path);
+    unlink(path);
+    std::string block(1 << 20, 'x');
+    for (int64_t offset = 0; offset < kSize; offset += block.size()) {
+      pwrite(fd_, block.data(), block.size(), offset);
+    }
+  }
+
+  int fd_ = -1;
+};
+
+// Reads of 4 KiB blocks in batches of queue depth, arguments are queue
+// depth, whether offsets are random and whether io_uring is used.
+static void BM_AsyncRead(benchmark::State& state) {
+  const size_t kBlockSize = 4096;
+  const int64_t kBlockCount = BenchFile::kSize / kBlockSize;
+  size_t queue_depth = state.range(0);
+  bool is_random = state.range(1);
+
+  std::unique_ptr<IoService> io_service;
+  if (state.range(2)) {
+    io_service = UringIoService::Create();
+    if (io_service == nullptr) {
+      state.SkipWithError("io_uring isn't supported");
+      return;
+    }
+  } else {
+    io_service = std::make_unique<BlockingIoService>();
+  }
+
+  const BenchFile& file = BenchFile::Get();
+  std::mt19937_64 random(0);
+  int64_t next_block = 0;
+  std::vector<IoRange> ranges(queue_depth);
+  for (auto _ : state) {
+    for (IoRange& range : ranges) {
+      int64_t block = is_random ? random() % kBlockCount
+                                : next_block++ % kBlockCount;
+      range = {block * int64_t(kBlockSize), kBlockSize};
+    }
+    auto reads = AsyncReadRanges(file.GetFd(), ranges, GetDefaultExecutor(),
+                                 io_service.get());
+    for (const auto& read : reads) {
+      benchmark::DoNotOptimize(read->Wait());
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * queue_depth * kBlockSize);
+  state.SetItemsProcessed(state.iterations() * queue_depth);
+}
+BENCHMARK(BM_AsyncRead)->UseRealTime()->ArgNames({"depth", "random", "uring"})
+    ->ArgsProduct({{1, 4, 16, 64}, {0, 1}, {0, 1}});
+
+// Producers send by TrySend and fall back to the parking Send only when
+// the channel is full, consumers take batches by ForEachBatch on the
+// default pool. Arguments are the numbers of producers and consumers.
+static void BM_Channel(benchmark::State& state) {
+  const int64_t kCount = 1 << 20;
+  const size_t kCapacity = 1024;
+  const size_t kBatchSize = 64;
+  int producer_count = state.range(0);
+  int consumer_count = state.range(1);
+
+  for (auto _ : state) {
+    auto channel = std::make_shared<Channel<int64_t>>(kCapacity);
+    std::atomic<int64_t> sum(0);
+    auto consume = [&sum](std::vector<int64_t> values) {
+      sum.fetch_add(std::accumulate(values.begin(), values.end(),
+                                    int64_t(0)));
+    };
+    std::vector<std::shared_ptr<Promise<void>>> consumers;
+    for (int i = 0; i < consumer_count; i++) {
+      consumers.push_back(ForEachBatch(channel, consume, kBatchSize));
+    }
+
+    std::vector<std::thread> producers;
+    for (int i = 0; i < producer_count; i++) {
+      producers.emplace_back([&, i] {
+        for (int64_t value = i; value < kCount; value += producer_count) {
+          int64_t sent = value;
+          if (!channel->TrySend(std::move(sent))) {
+            channel->Send(value)->Wait();
+          }
+        }
+      });
+    }
+    for (auto& producer : producers) {
+      producer.join();
+    }
+    channel->Close();
+    WhenAll(consumers)->Wait();
+    benchmark::DoNotOptimize(sum.load());
+  }
+  state.SetItemsProcessed(state.iterations() * kCount);
+}
+BENCHMARK(BM_Channel)->UseRealTime()->Unit(benchmark::kMillisecond)
+    ->ArgNames({"producers", "consumers"})
+    ->Args({1, 1})->Args({4, 4})->Args({16, 16});
+
+#ifdef PROMISE_SUPPORTS_COROUTINES
+
+std::shared_ptr<Promise<int64_t>> ChainCoroutine(
+    std::shared_ptr<Executor> executor, int64_t length) {
+  int64_t value = 0;
+  for (int64_t i = 0; i < length; i++) {
+    value = co_await MakePromise([value] { return value + 1; }, executor);
+  }
+  co_return value;
+}
+
+// Same chain as a coroutine, which is suspended on each step.
+static void BM_CoroutineChain(benchmark::State& state) {
+  std::shared_ptr<Executor> pool = std::make_shared<ThreadPool>(1);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ChainCoroutine(pool, state.range(0))->Wait());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_CoroutineChain)->Arg(1)->Arg(100)->Arg(10'000);
+
+#endif
+
+BENCHMARK_MAIN();
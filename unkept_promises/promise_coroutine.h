@@ -0,0 +1,219 @@
+#pragma once
+
+#include "promise.h"
+
+// Coroutines need C++20, see PROMISE_COROUTINES option in CMakeLists.txt.
+#if defined(__cpp_impl_coroutine)
+
+#define PROMISE_SUPPORTS_COROUTINES
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+
+// Function returning std::shared_ptr<Promise<ResultType>> may be a
+// coroutine. It starts on the executor, which is passed as the first
+// argument, or on the default one, and returns right away, like
+// MakePromise. co_await on a promise suspends the coroutine without
+// blocking a thread, it is resumed on the executor of the coroutine once
+// the result is ready. Exceptions are rethrown from co_await, like from
+// Wait, and the exception of the coroutine is rethrown from its Wait.
+
+// Shared state of the coroutine promise. The result is set by the
+// coroutine itself, Invoke only moves it into the storage.
+template<typename ResultType>
+class CoroutineState final : public FunctionExecutor<ResultType> {
+ public:
+  template<typename Value>
+  void SetValue(Value&& value) {
+    value_.emplace(std::forward<Value>(value));
+  }
+
+  void SetException(std::exception_ptr exception) {
+    exception_ = std::move(exception);
+  }
+
+ protected:
+  void Invoke(ResultStorage<ResultType>* storage) override {
+    if (exception_ != nullptr) {
+      std::rethrow_exception(exception_);
+    }
+    auto take = [this]() -> ResultType {
+      if constexpr (!std::is_void_v<ResultType>) {
+        return std::move(*value_);
+      }
+    };
+    storage->Store(take);
+  }
+
+ private:
+  using Value = std::conditional_t<std::is_void_v<ResultType>, bool,
+                                   ResultType>;
+
+  std::optional<Value> value_;
+  std::exception_ptr exception_;
+};
+
+template<typename ResultType>
+class CoroutinePromise;
+
+template<typename ResultType>
+class CoroutinePromiseBase {
+ public:
+  template<typename... Args>
+  explicit CoroutinePromiseBase(const Args&...)
+      : executor_(GetDefaultExecutor()) {
+  }
+
+  template<typename... Args>
+  CoroutinePromiseBase(const std::shared_ptr<Executor>& executor,
+                       const Args&...)
+      : executor_(executor) {
+  }
+
+  std::shared_ptr<Promise<ResultType>> get_return_object() {
+    return std::make_shared<Promise<ResultType>>(state_, executor_);
+  }
+
+  // Coroutine starts on the executor, so the caller isn't blocked.
+  auto initial_suspend() {
+    struct Awaiter {
+      bool await_ready() {
+        return false;
+      }
+
+      void await_suspend(std::coroutine_handle<> handle) {
+        executor->Submit([handle]() { handle.resume(); });
+      }
+
+      void await_resume() {
+      }
+
+      Executor* executor;
+    };
+    return Awaiter{executor_.get()};
+  }
+
+  // Frame is destroyed before the result is published, so the waiter
+  // can't outlive the arguments of the coroutine, like its executor.
+  auto final_suspend() noexcept {
+    struct Awaiter {
+      bool await_ready() noexcept {
+        return false;
+      }
+
+      void await_suspend(std::coroutine_handle<CoroutinePromise<ResultType>>
+                             handle) noexcept {
+        CoroutinePromiseBase& promise = handle.promise();
+        auto state = std::move(promise.state_);
+        handle.destroy();
+
+        InlineExecutor executor;
+        state->Execute(&executor);
+      }
+
+      void await_resume() noexcept {
+      }
+    };
+    return Awaiter{};
+  }
+
+  void unhandled_exception() {
+    state_->SetException(std::current_exception());
+  }
+
+  const std::shared_ptr<Executor>& GetExecutor() const {
+    return executor_;
+  }
+
+ protected:
+  std::shared_ptr<CoroutineState<ResultType>> state_ =
+      std::make_shared<CoroutineState<ResultType>>();
+  std::shared_ptr<Executor> executor_;
+};
+
+template<typename ResultType>
+class CoroutinePromise : public CoroutinePromiseBase<ResultType> {
+ public:
+  using CoroutinePromiseBase<ResultType>::CoroutinePromiseBase;
+
+  template<typename Value>
+  void return_value(Value&& value) {
+    this->state_->SetValue(std::forward<Value>(value));
+  }
+};
+
+template<>
+class CoroutinePromise<void> : public CoroutinePromiseBase<void> {
+ public:
+  using CoroutinePromiseBase<void>::CoroutinePromiseBase;
+
+  void return_void() {
+  }
+};
+
+template<typename ResultType, typename... Args>
+struct std::coroutine_traits<std::shared_ptr<Promise<ResultType>>, Args...> {
+  using promise_type = CoroutinePromise<ResultType>;
+};
+
+template<typename PromiseType>
+struct IsCoroutinePromise : std::false_type {
+};
+
+template<typename ResultType>
+struct IsCoroutinePromise<CoroutinePromise<ResultType>> : std::true_type {
+};
+
+// Result is copied, as the promise may have other readers.
+template<typename ResultType>
+class PromiseAwaiter {
+ public:
+  explicit PromiseAwaiter(const Promise<ResultType>& promise)
+      : state_(promise.GetFunctionExecutor()),
+        executor_(promise.GetExecutor()) {
+  }
+
+  bool await_ready() const {
+    return state_->IsReady();
+  }
+
+  // Coroutines of promises are resumed on their own executor, others
+  // on the executor of the awaited promise.
+  template<typename PromiseType>
+  void await_suspend(std::coroutine_handle<PromiseType> handle) {
+    std::shared_ptr<Executor> executor = executor_;
+    if constexpr (IsCoroutinePromise<PromiseType>::value) {
+      executor = handle.promise().GetExecutor();
+    }
+    // Coroutine may be resumed and destroy this awaiter before Subscribe
+    // returns, so the state is kept by a local.
+    auto state = state_;
+    state->Subscribe([handle, executor = std::move(executor)]() {
+      executor->Submit([handle]() { handle.resume(); });
+    });
+  }
+
+  std::remove_cv_t<std::remove_reference_t<
+      typename FunctionExecutor<ResultType>::WaitResult>>
+  await_resume() {
+    if constexpr (std::is_void_v<ResultType>) {
+      state_->Wait();
+    } else {
+      return state_->Wait();
+    }
+  }
+
+ private:
+  std::shared_ptr<FunctionExecutor<ResultType>> state_;
+  std::shared_ptr<Executor> executor_;
+};
+
+template<typename ResultType>
+PromiseAwaiter<ResultType> operator co_await(
+    const std::shared_ptr<Promise<ResultType>>& promise) {
+  return PromiseAwaiter<ResultType>(*promise);
+}
+
+#endif
@@ -1,6 +1,22 @@
 #include "gtest.h"
 
 #include "promise.h"
+#include "async_io.h"
+#include "channel.h"
+#include "parallel.h"
+#include "priority_executor.h"
+#include "promise_coroutine.h"
+#include "task_graph.h"
+#include "timeout.h"
+#include "when.h"
+
+#include <cstdlib>
+#include <deque>
+#include <numeric>
+#include <sstream>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 TEST(PromiseConstructor, FunctionCalled) {
   std::atomic<bool> is_function_called(false);
@@ -359,3 +375,1241 @@ TEST(PromiseThenCatch, Simple) {
   ASSERT_EQ(ExpensiveComputation(0), PromiseCreator("0")->Wait());
   ASSERT_EQ(ExpensiveComputation(0), PromiseCreator("")->Wait());
 }
+
+class CountingExecutor : public Executor {
+ public:
+  void Submit(std::function<void()> task) override {
+    submitted_count.fetch_add(1);
+    pool.Submit(std::move(task));
+  }
+
+  std::atomic<int> submitted_count{0};
+  ThreadPool pool{2};
+};
+
+TEST(PromiseExecutor, CustomExecutor) {
+  auto executor = std::make_shared<CountingExecutor>();
+  auto promise = MakePromise([] { return 20; }, executor)
+      ->Then([](int value) { return value + 1; })
+      ->Catch([](const std::exception&) { return 0; });
+
+  ASSERT_EQ(21, promise->Wait());
+  ASSERT_EQ(3, executor->submitted_count.load());
+}
+
+TEST(PromiseExecutor, ManySmallTasks) {
+  std::vector<std::shared_ptr<Promise<int>>> promises;
+  for (int index = 0; index < 100'000; index++) {
+    promises.push_back(MakePromise([index] { return index % 7; }));
+  }
+
+  int64_t sum = 0;
+  for (auto& promise : promises) {
+    sum += promise->Wait();
+  }
+  ASSERT_EQ(299'995, sum);
+}
+
+TEST(ThreadPool, NestedWait) {
+  std::shared_ptr<Executor> pool = std::make_shared<ThreadPool>(1);
+  auto promise = MakePromise([&pool] {
+    return MakePromise([&pool] {
+      return MakePromise([] { return 42; }, pool)->Wait();
+    }, pool)->Wait();
+  }, pool);
+  ASSERT_EQ(42, promise->Wait());
+}
+
+TEST(ThreadPool, AllWorkersWait) {
+  // Tasks block every worker in Wait, and the functions they wait for
+  // are submitted only after that, behind the rest of the waiting tasks.
+  size_t task_count = 2 * ThreadPool::GetDefaultThreadCount();
+  std::shared_ptr<Executor> pool = std::make_shared<ThreadPool>();
+  std::vector<std::shared_ptr<FunctionExecutor<size_t>>> functions;
+  std::vector<std::shared_ptr<Promise<size_t>>> promises;
+  for (size_t index = 0; index < task_count; index++) {
+    functions.push_back(MakeFunctionTask<size_t>([index] { return index; }));
+    promises.push_back(MakePromise([function = functions.back()] {
+      return function->Wait();
+    }, pool));
+  }
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  for (const auto& function : functions) {
+    function->Execute(pool.get());
+  }
+  for (size_t index = 0; index < task_count; index++) {
+    ASSERT_EQ(index, promises[index]->Wait());
+  }
+}
+
+TEST(ThreadPool, TasksFinishedOnDestruction) {
+  std::atomic<int> finished_count(0);
+  {
+    ThreadPool pool(3);
+    for (int index = 0; index < 1000; index++) {
+      pool.Submit([&finished_count] { finished_count.fetch_add(1); });
+    }
+  }
+  ASSERT_EQ(1000, finished_count.load());
+}
+
+TEST(PromiseThen, DeepChainOnSingleThread) {
+  std::shared_ptr<Executor> pool = std::make_shared<ThreadPool>(1);
+  std::atomic<bool> is_started(false);
+  auto first = MakePromise([&is_started] {
+    while (!is_started.load()) {
+      std::this_thread::yield();
+    }
+    return 0;
+  }, pool);
+
+  // Nothing runs until the whole chain is built, and no stage blocks
+  // the only worker while waiting for the previous one.
+  auto promise = first->Then([](int value) { return value + 1; });
+  for (int index = 1; index < 10'000; index++) {
+    promise = promise->Then([](int value) { return value + 1; });
+  }
+  is_started.store(true);
+  ASSERT_EQ(10'000, promise->Wait());
+}
+
+struct CopyCounter {
+  CopyCounter() = default;
+  CopyCounter(const CopyCounter& other) : copy_count(other.copy_count + 1) {
+  }
+  CopyCounter(CopyCounter&& other) = default;
+
+  int copy_count = 0;
+};
+
+TEST(PromiseWait, ResultNotCopied) {
+  auto promise = MakePromise([] { return CopyCounter(); });
+  ASSERT_EQ(0, promise->Wait().copy_count);
+  ASSERT_EQ(&promise->Wait(), &promise->Wait());
+  ASSERT_EQ(0, promise->Take().copy_count);
+}
+
+TEST(PromiseWait, MoveOnlyResult) {
+  auto promise = MakePromise([] { return std::make_unique<int>(42); })
+      ->Then([](const std::unique_ptr<int>& value) {
+        return std::make_unique<int>(*value / 2);
+      });
+
+  std::unique_ptr<int> result = promise->Take();
+  ASSERT_EQ(21, *result);
+  ASSERT_EQ(nullptr, promise->Wait());
+}
+
+TEST(PromiseWait, RvalueWaitMoves) {
+  Promise<std::vector<int>> promise([] { return std::vector<int>(100, 1); });
+  std::vector<int> result = std::move(promise).Wait();
+  ASSERT_EQ(100u, result.size());
+  ASSERT_TRUE(promise.Wait().empty());
+}
+
+TEST(WhenAll, Vector) {
+  std::vector<std::shared_ptr<Promise<int>>> promises;
+  for (int i = 0; i < 100; i++) {
+    promises.push_back(MakePromise([i] { return i; }));
+  }
+
+  auto results = WhenAll(promises)->Wait();
+  ASSERT_EQ(100u, results.size());
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQ(i, results[i]);
+  }
+}
+
+TEST(WhenAll, FanOutOnSingleThread) {
+  std::shared_ptr<Executor> pool = std::make_shared<ThreadPool>(1);
+
+  // Combinator runs on the only thread of the pool, while all the
+  // promises are still in its queue.
+  auto promise = MakePromise([pool] {
+    std::vector<std::shared_ptr<Promise<int64_t>>> promises;
+    for (int64_t i = 0; i < 10'000; i++) {
+      promises.push_back(MakePromise([i] { return i; }, pool));
+    }
+    return WhenAll(promises, pool)->Then([](const std::vector<int64_t>& v) {
+      return std::accumulate(v.begin(), v.end(), int64_t(0));
+    });
+  }, pool);
+  ASSERT_EQ(49'995'000, promise->Wait()->Wait());
+}
+
+TEST(WhenAll, Void) {
+  std::atomic<int> counter(0);
+  std::vector<std::shared_ptr<Promise<void>>> promises;
+  for (int i = 0; i < 10; i++) {
+    promises.push_back(MakePromise([&counter] { counter.fetch_add(1); }));
+  }
+
+  WhenAll(promises)->Wait();
+  ASSERT_EQ(10, counter.load());
+}
+
+TEST(WhenAll, Empty) {
+  std::vector<std::shared_ptr<Promise<int>>> promises;
+  ASSERT_TRUE(WhenAll(promises)->Wait().empty());
+}
+
+TEST(WhenAll, Tuple) {
+  auto promise = WhenAll(MakePromise([] { return 42; }),
+                         MakePromise([] { return std::string("abc"); }),
+                         MakePromise([] { return 0.5; }));
+  ASSERT_EQ(std::make_tuple(42, std::string("abc"), 0.5), promise->Wait());
+}
+
+TEST(WhenAll, ExceptionThrown) {
+  std::vector<std::shared_ptr<Promise<int>>> promises;
+  promises.push_back(MakePromise([] { return 1; }));
+  promises.push_back(MakePromise([]() -> int {
+    throw std::runtime_error("error");
+  }));
+  promises.push_back(MakePromise([] { return 3; }));
+
+  ASSERT_THROW(WhenAll(promises)->Wait(), std::runtime_error);
+}
+
+TEST(WhenAny, FirstWins) {
+  std::shared_ptr<Executor> pool = std::make_shared<ThreadPool>(3);
+  std::vector<std::shared_ptr<Promise<int>>> promises;
+  for (int i = 0; i < 3; i++) {
+    promises.push_back(MakePromise([i] {
+      if (i != 1) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+      }
+      return i * 10;
+    }, pool));
+  }
+
+  auto result = WhenAny(promises, pool)->Wait();
+  ASSERT_EQ(1u, result.index);
+  ASSERT_EQ(10, result.value);
+}
+
+TEST(WhenAny, Void) {
+  std::vector<std::shared_ptr<Promise<void>>> promises;
+  promises.push_back(MakePromise([] {}));
+  ASSERT_EQ(0u, WhenAny(promises)->Wait().index);
+}
+
+TEST(WhenAny, ExceptionThrown) {
+  std::vector<std::shared_ptr<Promise<int>>> promises;
+  promises.push_back(MakePromise([]() -> int {
+    throw std::runtime_error("error");
+  }));
+  ASSERT_THROW(WhenAny(promises)->Wait(), std::runtime_error);
+}
+
+TEST(WhenAny, Empty) {
+  std::vector<std::shared_ptr<Promise<int>>> promises;
+  ASSERT_THROW(WhenAny(promises), std::invalid_argument);
+}
+
+#ifdef PROMISE_SUPPORTS_COROUTINES
+
+std::shared_ptr<Promise<int>> AddCoroutine(int a, int b) {
+  int first = co_await MakePromise([a] { return a; });
+  int second = co_await MakePromise([b] { return b; });
+  co_return first + second;
+}
+
+std::shared_ptr<Promise<void>> IncrementCoroutine(std::atomic<int>* value) {
+  co_await MakePromise([value] { value->fetch_add(1); });
+  value->fetch_add(1);
+}
+
+std::shared_ptr<Promise<int>> ThrowingCoroutine() {
+  co_await MakePromise([] {});
+  throw std::runtime_error("error");
+}
+
+std::shared_ptr<Promise<std::string>> CatchingCoroutine() {
+  try {
+    co_return co_await MakePromise([]() -> std::string {
+      throw std::runtime_error("error");
+    });
+  } catch (const std::runtime_error& error) {
+    co_return error.what();
+  }
+}
+
+std::shared_ptr<Promise<int64_t>> SumCoroutine(
+    std::shared_ptr<Executor> executor, int64_t count) {
+  int64_t sum = 0;
+  for (int64_t i = 0; i < count; i++) {
+    sum += co_await MakePromise([i] { return i; }, executor);
+  }
+  co_return sum;
+}
+
+std::shared_ptr<Promise<int>> NestedCoroutine() {
+  int sum = co_await AddCoroutine(1, 2);
+  co_return sum + co_await AddCoroutine(3, 4);
+}
+
+TEST(PromiseCoroutine, ResultReturned) {
+  ASSERT_EQ(42, AddCoroutine(40, 2)->Wait());
+}
+
+TEST(PromiseCoroutine, Void) {
+  std::atomic<int> value(0);
+  IncrementCoroutine(&value)->Wait();
+  ASSERT_EQ(2, value.load());
+}
+
+TEST(PromiseCoroutine, ExceptionThrown) {
+  ASSERT_THROW(ThrowingCoroutine()->Wait(), std::runtime_error);
+}
+
+TEST(PromiseCoroutine, ExceptionFromAwait) {
+  ASSERT_EQ("error", CatchingCoroutine()->Wait());
+}
+
+TEST(PromiseCoroutine, Nested) {
+  ASSERT_EQ(10, NestedCoroutine()->Wait());
+}
+
+TEST(PromiseCoroutine, ThenAfterCoroutine) {
+  auto promise = AddCoroutine(1, 1)->Then([](int value) {
+    return value * 21;
+  });
+  ASSERT_EQ(42, promise->Wait());
+}
+
+TEST(PromiseCoroutine, DeepAwaitOnSingleThread) {
+  std::shared_ptr<Executor> pool = std::make_shared<ThreadPool>(1);
+  ASSERT_EQ(49'995'000, SumCoroutine(pool, 10'000)->Wait());
+}
+
+#endif
+
+TEST(PromiseCancellation, NotStartedStagesSkipped) {
+  std::shared_ptr<Executor> pool = std::make_shared<ThreadPool>(1);
+  CancellationSource source;
+  std::atomic<bool> is_started(false);
+  std::atomic<int> stages_run(0);
+
+  auto promise = MakePromise([&is_started, &source] {
+    is_started.store(true);
+    while (!source.IsCancelled()) {
+      std::this_thread::yield();
+    }
+    return 1;
+  }, pool, source.GetToken())->Then([&stages_run](int value) {
+    stages_run.fetch_add(1);
+    return value + 1;
+  })->Then([&stages_run](int value) {
+    stages_run.fetch_add(1);
+    return value + 1;
+  });
+
+  while (!is_started.load()) {
+    std::this_thread::yield();
+  }
+  source.Cancel();
+  ASSERT_THROW(promise->Wait(), CancelledError);
+  ASSERT_EQ(0, stages_run.load());
+}
+
+TEST(PromiseCancellation, CancelledBeforeStart) {
+  CancellationSource source;
+  source.Cancel();
+  std::atomic<bool> is_called(false);
+
+  auto promise = MakePromise([&is_called] { is_called.store(true); },
+                             GetDefaultExecutor(), source.GetToken());
+  ASSERT_THROW(promise->Wait(), CancelledError);
+  ASSERT_FALSE(is_called.load());
+}
+
+TEST(PromiseCancellation, RunningFunctionPollsToken) {
+  CancellationSource source;
+  auto token = source.GetToken();
+
+  auto promise = MakePromise([token] {
+    while (true) {
+      token.ThrowIfCancelled();
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }, GetDefaultExecutor(), token);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  source.Cancel();
+  ASSERT_THROW(promise->Wait(), CancelledError);
+}
+
+TEST(PromiseCancellation, CatchHandlesCancellation) {
+  CancellationSource source;
+  source.Cancel();
+
+  auto promise = MakePromise([] { return 1; }, GetDefaultExecutor(),
+                             source.GetToken())
+      ->Then([](int value) { return value + 1; })
+      ->Catch([](const std::exception& exception) {
+        return dynamic_cast<const CancelledError*>(&exception) != nullptr
+            ? -1 : 0;
+      });
+  ASSERT_EQ(-1, promise->Wait());
+}
+
+TEST(PromiseCancellation, NotCancelled) {
+  CancellationSource source;
+  auto promise = MakePromise([] { return 1; }, GetDefaultExecutor(),
+                             source.GetToken())
+      ->Then([](int value) { return value + 1; });
+  ASSERT_EQ(2, promise->Wait());
+  ASSERT_FALSE(promise->GetToken().IsCancelled());
+}
+
+TEST(ParallelFor, AllIndicesVisited) {
+  std::vector<std::atomic<int>> visits(10'000);
+  ParallelFor(0, 10'000, [&visits](int64_t index) {
+    visits[index].fetch_add(1);
+  }, GetDefaultExecutor(), 100)->Wait();
+
+  for (const auto& visit : visits) {
+    ASSERT_EQ(1, visit.load());
+  }
+}
+
+TEST(ParallelFor, EmptyRange) {
+  std::atomic<int> calls(0);
+  ParallelFor(5, 5, [&calls](int64_t) { calls.fetch_add(1); })->Wait();
+  ASSERT_EQ(0, calls.load());
+}
+
+TEST(ParallelFor, NestedOnSingleThread) {
+  std::shared_ptr<Executor> pool = std::make_shared<ThreadPool>(1);
+  std::atomic<int64_t> sum(0);
+
+  ParallelFor(0, 10, [&pool, &sum](int64_t i) {
+    ParallelFor(0, 100, [&sum, i](int64_t j) {
+      sum.fetch_add(i * 100 + j);
+    }, pool, 10)->Wait();
+  }, pool, 1)->Wait();
+  ASSERT_EQ(499'500, sum.load());
+}
+
+// Keeps tasks until the test runs them.
+class QueueExecutor : public Executor {
+ public:
+  void Submit(std::function<void()> task) override {
+    tasks.push_back(std::move(task));
+  }
+
+  void RunAll() {
+    while (!tasks.empty()) {
+      auto task = std::move(tasks.front());
+      tasks.pop_front();
+      task();
+    }
+  }
+
+  std::deque<std::function<void()>> tasks;
+};
+
+TEST(ParallelFor, SplitInTasks) {
+  auto executor = std::make_shared<QueueExecutor>();
+  int calls = 0;
+  auto promise = ParallelFor(0, 1000, [&calls](int64_t) { calls++; },
+                             executor, 10);
+  ASSERT_EQ(1u, executor->tasks.size());
+  ASSERT_EQ(0, calls);
+
+  executor->RunAll();
+  ASSERT_EQ(1000, calls);
+  promise->Wait();
+}
+
+TEST(ParallelFor, ExceptionThrown) {
+  auto promise = ParallelFor(0, 1000, [](int64_t index) {
+    if (index == 500) {
+      throw std::runtime_error("error");
+    }
+  }, GetDefaultExecutor(), 10);
+  ASSERT_THROW(promise->Wait(), std::runtime_error);
+}
+
+TEST(ParallelTransform, ResultsInOrder) {
+  auto results = ParallelTransform(10, 1010, [](int64_t index) {
+    return index * index;
+  }, GetDefaultExecutor(), 7)->Take();
+
+  ASSERT_EQ(1000u, results.size());
+  for (int64_t i = 0; i < 1000; i++) {
+    ASSERT_EQ((i + 10) * (i + 10), results[i]);
+  }
+}
+
+TEST(ParallelReduce, Sum) {
+  auto promise = ParallelReduce(int64_t(0), int64_t(100'000), int64_t(0),
+                                [](int64_t index) { return index; },
+                                std::plus<int64_t>());
+  ASSERT_EQ(4'999'950'000, promise->Wait());
+}
+
+TEST(ParallelReduce, NonCommutative) {
+  auto promise = ParallelReduce(0, 26, std::string(), [](int64_t index) {
+    return std::string(1, 'a' + index);
+  }, std::plus<std::string>(), GetDefaultExecutor(), 3);
+  ASSERT_EQ("abcdefghijklmnopqrstuvwxyz", promise->Wait());
+}
+
+TEST(TaskGraph, Diamond) {
+  TaskGraph graph;
+  int a = 0;
+  int b = 0;
+  int c = 0;
+  int d = 0;
+  auto first = graph.AddNode("a", [&a] { a = 1; });
+  auto left = graph.AddNode("b", [&a, &b] { b = a + 1; }, {first});
+  auto right = graph.AddNode("c", [&a, &c] { c = a * 10; }, {first});
+  graph.AddNode("d", [&b, &c, &d] { d = b + c; }, {left, right});
+
+  auto report = graph.Run()->Wait();
+  ASSERT_EQ(12, d);
+  ASSERT_EQ(4u, report.node_seconds.size());
+}
+
+TEST(TaskGraph, Reusable) {
+  TaskGraph graph;
+  std::atomic<int> counter(0);
+  std::vector<TaskGraph::NodeId> layer;
+  for (int i = 0; i < 10; i++) {
+    layer.push_back(graph.AddNode("first", [&counter] {
+      counter.fetch_add(1);
+    }));
+  }
+  graph.AddNode("last", [&counter] { counter.fetch_add(100); }, layer);
+
+  for (int run = 0; run < 1000; run++) {
+    graph.Run()->Wait();
+  }
+  ASSERT_EQ(110'000, counter.load());
+}
+
+TEST(TaskGraph, ConcurrentRuns) {
+  TaskGraph graph;
+  std::atomic<int> counter(0);
+  auto first = graph.AddNode("first", [&counter] { counter.fetch_add(1); });
+  graph.AddNode("second", [&counter] { counter.fetch_add(1); }, {first});
+
+  std::vector<std::shared_ptr<Promise<TaskGraphReport>>> runs;
+  for (int run = 0; run < 100; run++) {
+    runs.push_back(graph.Run());
+  }
+  WhenAll(runs)->Wait();
+  ASSERT_EQ(200, counter.load());
+}
+
+TEST(TaskGraph, CriticalPath) {
+  TaskGraph graph;
+  auto sleep = [](int milliseconds) {
+    return [milliseconds] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+    };
+  };
+  auto start = graph.AddNode("start", sleep(1));
+  auto fast = graph.AddNode("fast", sleep(1), {start});
+  auto slow = graph.AddNode("slow", sleep(100), {start});
+  auto end = graph.AddNode("end", sleep(1), {fast, slow});
+
+  auto report = graph.Run()->Wait();
+  std::vector<TaskGraph::NodeId> critical_path = {start, slow, end};
+  ASSERT_EQ(critical_path, report.critical_path);
+  ASSERT_GE(report.critical_path_seconds, 0.1);
+  ASSERT_GE(report.seconds, report.critical_path_seconds * 0.99);
+
+  std::ostringstream out;
+  graph.PrintReport(report, &out);
+  ASSERT_NE(std::string::npos, out.str().find("* slow"));
+  ASSERT_NE(std::string::npos, out.str().find("  fast"));
+}
+
+TEST(TaskGraph, ExceptionStopsDependents) {
+  TaskGraph graph;
+  std::atomic<bool> is_called(false);
+  auto failing = graph.AddNode("failing", [] {
+    throw std::runtime_error("error");
+  });
+  graph.AddNode("dependent", [&is_called] { is_called.store(true); },
+                {failing});
+
+  ASSERT_THROW(graph.Run()->Wait(), std::runtime_error);
+  ASSERT_FALSE(is_called.load());
+}
+
+// Counts its instances, which are still alive.
+class CountedExecutor : public Executor {
+ public:
+  explicit CountedExecutor(std::atomic<int>* alive_count)
+      : alive_count_(alive_count) {
+    alive_count_->fetch_add(1);
+  }
+
+  ~CountedExecutor() override {
+    alive_count_->fetch_sub(1);
+  }
+
+  void Submit(std::function<void()> task) override {
+    GetDefaultExecutor()->Submit(std::move(task));
+  }
+
+ private:
+  std::atomic<int>* alive_count_;
+};
+
+TEST(TaskGraph, FailedRunIsReleased) {
+  TaskGraph graph;
+  auto failing = graph.AddNode("failing", [] {
+    throw std::runtime_error("error");
+  });
+  graph.AddNode("dependent", [] {}, {failing});
+
+  std::atomic<int> alive_count(0);
+  ASSERT_THROW(graph.Run(std::make_shared<CountedExecutor>(&alive_count))
+                   ->Wait(),
+               std::runtime_error);
+  // The last node may still be returning, after it has completed the run.
+  for (int attempt = 0; attempt < 1000 && alive_count.load() != 0;
+       attempt++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_EQ(0, alive_count.load());
+}
+
+// Runs the first accepted_count tasks in place and rejects the rest.
+class RejectingExecutor : public Executor {
+ public:
+  explicit RejectingExecutor(int accepted_count)
+      : accepted_count_(accepted_count) {
+  }
+
+  void Submit(std::function<void()> task) override {
+    if (accepted_count_.fetch_sub(1) <= 0) {
+      throw RejectedError();
+    }
+    task();
+  }
+
+ private:
+  std::atomic<int> accepted_count_;
+};
+
+TEST(TaskGraph, RejectedNodes) {
+  // Last run rejects only the task, which completes the promise.
+  for (int accepted_count = 0; accepted_count <= 4; accepted_count++) {
+    TaskGraph graph;
+    std::atomic<int> called_count(0);
+    auto count = [&called_count] { called_count.fetch_add(1); };
+    auto first = graph.AddNode("first", count);
+    auto second = graph.AddNode("second", count, {first});
+    graph.AddNode("third", count, {second});
+    graph.AddNode("other", count);
+
+    auto promise =
+        graph.Run(std::make_shared<RejectingExecutor>(accepted_count));
+    ASSERT_THROW(promise->Wait(), RejectedError);
+    ASSERT_EQ(accepted_count, called_count.load());
+  }
+}
+
+TEST(TaskGraph, Empty) {
+  TaskGraph graph;
+  ASSERT_TRUE(graph.Run()->Wait().critical_path.empty());
+}
+
+TEST(TaskGraph, UnknownDependency) {
+  TaskGraph graph;
+  ASSERT_THROW(graph.AddNode("node", [] {}, {0}), std::invalid_argument);
+}
+
+// Blocks the workers of an executor until Release.
+class Gate {
+ public:
+  void Wait() {
+    std::unique_lock unique_lock(mutex_);
+    cv_.wait(unique_lock, [this] { return is_open_; });
+  }
+
+  void Release() {
+    std::lock_guard lock_guard(mutex_);
+    is_open_ = true;
+    cv_.notify_all();
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool is_open_ = false;
+};
+
+TEST(PriorityExecutor, MaxConcurrency) {
+  auto executor = std::make_shared<PriorityExecutor>(2, 100);
+  std::atomic<int> running(0);
+  std::atomic<int> max_running(0);
+
+  std::vector<std::shared_ptr<Promise<void>>> promises;
+  for (int i = 0; i < 20; i++) {
+    promises.push_back(MakePromise([&running, &max_running] {
+      int current = running.fetch_add(1) + 1;
+      int max = max_running.load();
+      while (current > max && !max_running.compare_exchange_weak(max,
+                                                                current)) {
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      running.fetch_sub(1);
+    }, executor));
+  }
+  WhenAll(promises, executor)->Wait();
+  ASSERT_LE(max_running.load(), 2);
+  // Functions and the task of WhenAll.
+  ASSERT_EQ(21, executor->GetStats().submitted_count);
+}
+
+TEST(PriorityExecutor, HighPriorityFirst) {
+  auto executor = std::make_shared<PriorityExecutor>(1, 100);
+  Gate gate;
+  std::mutex order_mutex;
+  std::vector<int> order;
+
+  auto blocker = MakePromise([&gate] { gate.Wait(); }, executor);
+  std::vector<std::shared_ptr<Promise<void>>> promises;
+  for (int i = 0; i < 3; i++) {
+    for (Priority priority : {Priority::kLow, Priority::kHigh}) {
+      promises.push_back(MakePromise([&order_mutex, &order, priority] {
+        std::lock_guard lock_guard(order_mutex);
+        order.push_back(static_cast<int>(priority));
+      }, executor->GetExecutor(priority)));
+    }
+  }
+  gate.Release();
+  WhenAll(promises, executor)->Wait();
+
+  std::vector<int> expected = {0, 0, 0, 2, 2, 2};
+  ASSERT_EQ(expected, order);
+}
+
+TEST(PriorityExecutor, RejectWhenFull) {
+  auto executor = std::make_shared<PriorityExecutor>(1, 2,
+                                                     OverflowPolicy::kReject);
+  Gate gate;
+  auto blocker = MakePromise([&gate] { gate.Wait(); }, executor);
+  while (executor->GetStats().queue_size > 0) {
+    std::this_thread::yield();
+  }
+
+  auto first = MakePromise([] { return 1; }, executor);
+  auto second = MakePromise([] { return 2; }, executor);
+  auto rejected = MakePromise([] { return 3; }, executor);
+  gate.Release();
+  ASSERT_THROW(rejected->Wait(), RejectedError);
+  ASSERT_EQ(1, first->Wait());
+  ASSERT_EQ(2, second->Wait());
+  ASSERT_EQ(1, executor->GetStats().rejected_count);
+}
+
+TEST(PriorityExecutor, BlockWhenFull) {
+  auto executor = std::make_shared<PriorityExecutor>(1, 1,
+                                                     OverflowPolicy::kBlock);
+  Gate gate;
+  auto blocker = MakePromise([&gate] { gate.Wait(); }, executor);
+  while (executor->GetStats().queue_size > 0) {
+    std::this_thread::yield();
+  }
+  auto queued = MakePromise([] { return 1; }, executor);
+
+  std::atomic<bool> is_submitted(false);
+  std::thread submitter([&executor, &is_submitted] {
+    executor->Submit([] {});
+    is_submitted.store(true);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  ASSERT_FALSE(is_submitted.load());
+
+  gate.Release();
+  submitter.join();
+  ASSERT_TRUE(is_submitted.load());
+  ASSERT_EQ(1, queued->Wait());
+}
+
+TEST(PriorityExecutor, RunInCallerWhenFull) {
+  auto executor = std::make_shared<PriorityExecutor>(
+      1, 1, OverflowPolicy::kRunInCaller);
+  Gate gate;
+  auto blocker = MakePromise([&gate] { gate.Wait(); }, executor);
+  while (executor->GetStats().queue_size > 0) {
+    std::this_thread::yield();
+  }
+  auto queued = MakePromise([] {}, executor);
+
+  auto caller = std::this_thread::get_id();
+  auto overflow = MakePromise([] { return std::this_thread::get_id(); },
+                              executor);
+  ASSERT_EQ(caller, overflow->Wait());
+  gate.Release();
+  ASSERT_EQ(1, executor->GetStats().run_in_caller_count);
+}
+
+TEST(PriorityExecutor, ContinuationsBypassBound) {
+  auto executor = std::make_shared<PriorityExecutor>(1, 1,
+                                                     OverflowPolicy::kReject);
+  auto promise = MakePromise([] { return 0; }, executor);
+  for (int i = 0; i < 100; i++) {
+    promise = promise->Then([](int value) { return value + 1; });
+  }
+  ASSERT_EQ(100, promise->Wait());
+}
+
+TEST(PromiseWaitFor, TimedOut) {
+  Gate gate;
+  auto promise = MakePromise([&gate] {
+    gate.Wait();
+    return 42;
+  });
+  ASSERT_FALSE(promise->WaitFor(std::chrono::milliseconds(10)));
+  ASSERT_FALSE(promise->WaitUntil(std::chrono::system_clock::now() +
+                                  std::chrono::milliseconds(10)));
+
+  gate.Release();
+  ASSERT_TRUE(promise->WaitFor(std::chrono::seconds(10)));
+  ASSERT_EQ(42, promise->Wait());
+}
+
+TEST(PromiseWaitFor, ExceptionNotThrown) {
+  auto promise = MakePromise([] { throw std::runtime_error("error"); });
+  ASSERT_TRUE(promise->WaitFor(std::chrono::seconds(10)));
+  ASSERT_THROW(promise->Wait(), std::runtime_error);
+}
+
+TEST(Delay, NotEarlier) {
+  auto start = std::chrono::steady_clock::now();
+  Delay(std::chrono::milliseconds(50))->Wait();
+  ASSERT_GE(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(50));
+}
+
+TEST(Delay, Order) {
+  std::mutex order_mutex;
+  std::vector<int> order;
+  std::vector<std::shared_ptr<Promise<void>>> promises;
+  for (int delay : {30, 10, 20}) {
+    promises.push_back(Delay(std::chrono::milliseconds(delay))->Then(
+        [&order_mutex, &order, delay] {
+          std::lock_guard lock_guard(order_mutex);
+          order.push_back(delay);
+        }));
+  }
+  WhenAll(promises)->Wait();
+
+  std::vector<int> expected = {10, 20, 30};
+  ASSERT_EQ(expected, order);
+}
+
+TEST(WithTimeout, TimedOut) {
+  Gate gate;
+  auto promise = MakePromise([&gate] {
+    gate.Wait();
+    return 42;
+  });
+
+  auto start = std::chrono::steady_clock::now();
+  auto timed = WithTimeout(promise, std::chrono::milliseconds(20));
+  ASSERT_THROW(timed->Wait(), TimeoutError);
+  ASSERT_GE(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(20));
+  ASSERT_EQ(-1, timed->Catch([](const std::exception&) { return -1; })
+                    ->Wait());
+  gate.Release();
+}
+
+TEST(WithTimeout, ReadyInTime) {
+  auto promise = WithTimeout(MakePromise([] { return 42; }),
+                             std::chrono::seconds(10));
+  ASSERT_EQ(42, promise->Wait());
+}
+
+TEST(WithTimeout, ExceptionPassed) {
+  auto promise = WithTimeout(MakePromise([]() -> int {
+    throw std::runtime_error("error");
+  }), std::chrono::seconds(10));
+  ASSERT_THROW(promise->Wait(), std::runtime_error);
+}
+
+TEST(WithTimeout, TimerCancelled) {
+  TimerWheel timer_wheel;
+  auto promise = WithTimeout(MakePromise([] { return 42; }),
+                             std::chrono::hours(1), &timer_wheel);
+  ASSERT_EQ(42, promise->Wait());
+  ASSERT_EQ(0u, timer_wheel.GetPendingCount());
+}
+
+TEST(TimerWheel, Cancel) {
+  TimerWheel timer_wheel;
+  auto start = TimerWheel::Clock::now();
+  std::atomic<int> fired_count(0);
+  auto owner = std::make_shared<int>(0);
+
+  std::vector<TimerWheel::Handle> handles;
+  for (int i = 0; i < 10; i++) {
+    handles.push_back(timer_wheel.Schedule(
+        start + std::chrono::milliseconds(20), [&fired_count, owner] {
+          fired_count.fetch_add(1);
+        }));
+  }
+  for (int i = 0; i < 10; i += 2) {
+    ASSERT_TRUE(timer_wheel.Cancel(handles[i]));
+    ASSERT_FALSE(timer_wheel.Cancel(handles[i]));
+  }
+  ASSERT_EQ(5u, timer_wheel.GetPendingCount());
+  ASSERT_EQ(6, owner.use_count());
+
+  while (fired_count.load() < 5) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  ASSERT_FALSE(timer_wheel.Cancel(handles[1]));
+  ASSERT_FALSE(timer_wheel.Cancel(TimerWheel::Handle()));
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  ASSERT_EQ(5, fired_count.load());
+}
+
+TEST(TimerWheel, ManyTimers) {
+  TimerWheel timer_wheel;
+  const int kTimerCount = 100'000;
+  std::atomic<int> fired_count(0);
+  std::atomic<int> early_count(0);
+
+  auto now = TimerWheel::Clock::now();
+  for (int i = 0; i < kTimerCount; i++) {
+    auto deadline = now + std::chrono::microseconds(i * 7 % 300'000);
+    timer_wheel.Schedule(deadline, [deadline, &fired_count, &early_count] {
+      if (TimerWheel::Clock::now() < deadline) {
+        early_count.fetch_add(1);
+      }
+      fired_count.fetch_add(1);
+    });
+  }
+
+  while (fired_count.load() < kTimerCount) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  ASSERT_EQ(0, early_count.load());
+  ASSERT_EQ(0u, timer_wheel.GetPendingCount());
+}
+
+TEST(TimerWheel, UpperLevels) {
+  TimerWheel timer_wheel;
+  std::atomic<int> fired_count(0);
+  auto start = TimerWheel::Clock::now();
+  std::vector<TimerWheel::Clock::duration> fired(3);
+
+  // Deadlines are in the second level of the wheel, one of them after
+  // some ticks have already passed.
+  for (int i : {0, 1}) {
+    auto delay = std::chrono::milliseconds(300 + 300 * i);
+    timer_wheel.Schedule(start + delay, [&, i] {
+      fired[i] = TimerWheel::Clock::now() - start;
+      fired_count.fetch_add(1);
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  timer_wheel.Schedule(start + std::chrono::milliseconds(400), [&] {
+    fired[2] = TimerWheel::Clock::now() - start;
+    fired_count.fetch_add(1);
+  });
+
+  while (fired_count.load() < 3) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  ASSERT_GE(fired[0], std::chrono::milliseconds(300));
+  ASSERT_GE(fired[1], std::chrono::milliseconds(600));
+  ASSERT_GE(fired[2], std::chrono::milliseconds(400));
+  ASSERT_LT(fired[0], fired[2]);
+  ASSERT_LT(fired[2], fired[1]);
+}
+
+// Temporary file, which is removed on destruction.
+class TempFile {
+ public:
+  TempFile() {
+    char path[] = "/tmp/promise_tests_XXXXXX";
+    fd_ = mkstemp(path);
+    path_ = path;
+  }
+
+  ~TempFile() {
+    close(fd_);
+    unlink(path_.c_str());
+  }
+
+  int GetFd() const {
+    return fd_;
+  }
+
+ private:
+  int fd_ = -1;
+  std::string path_;
+};
+
+void TestReadWrite(IoService* io_service) {
+  TempFile file;
+  std::string data(100'000, 0);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = 'a' + i % 26;
+  }
+  auto write = AsyncWrite(file.GetFd(), 0, data, GetDefaultExecutor(),
+                          io_service);
+  ASSERT_EQ(data.size(), write->Wait());
+
+  std::vector<IoRange> ranges;
+  for (int64_t offset = 0; offset < 120'000; offset += 4096) {
+    ranges.push_back({offset, 4096});
+  }
+  auto reads = AsyncReadRanges(file.GetFd(), ranges, GetDefaultExecutor(),
+                               io_service);
+  ASSERT_EQ(ranges.size(), reads.size());
+  for (size_t i = 0; i < ranges.size(); i++) {
+    // Ranges past the end of the file are short or empty.
+    size_t offset = std::min<size_t>(ranges[i].offset, data.size());
+    ASSERT_EQ(data.substr(offset, ranges[i].size), reads[i]->Wait());
+  }
+
+  auto read = AsyncRead(file.GetFd(), 26 * 100 + 3, 5, GetDefaultExecutor(),
+                        io_service);
+  ASSERT_EQ("defgh", read->Wait());
+}
+
+void TestBadFd(IoService* io_service) {
+  auto read = AsyncRead(-1, 0, 10, GetDefaultExecutor(), io_service);
+  ASSERT_THROW(read->Wait(), std::system_error);
+  auto write = AsyncWrite(-1, 0, "data", GetDefaultExecutor(), io_service);
+  ASSERT_THROW(write->Wait(), std::system_error);
+}
+
+TEST(AsyncIo, ReadWrite) {
+  TestReadWrite(&GetDefaultIoService());
+}
+
+TEST(AsyncIo, BlockingReadWrite) {
+  BlockingIoService io_service;
+  TestReadWrite(&io_service);
+}
+
+TEST(AsyncIo, UringReadWrite) {
+  auto io_service = UringIoService::Create();
+  if (io_service == nullptr) {
+    GTEST_SKIP() << "io_uring isn't supported";
+  }
+  TestReadWrite(io_service.get());
+}
+
+TEST(AsyncIo, BlockingBadFd) {
+  BlockingIoService io_service;
+  TestBadFd(&io_service);
+}
+
+TEST(AsyncIo, UringBadFd) {
+  auto io_service = UringIoService::Create();
+  if (io_service == nullptr) {
+    GTEST_SKIP() << "io_uring isn't supported";
+  }
+  TestBadFd(io_service.get());
+}
+
+TEST(AsyncIo, UringMoreThanEntries) {
+  // Batch doesn't fit into the rings, so it is submitted in parts.
+  auto io_service = UringIoService::Create(4);
+  if (io_service == nullptr) {
+    GTEST_SKIP() << "io_uring isn't supported";
+  }
+  TempFile file;
+  std::string data(1000, 'x');
+  ASSERT_EQ(data.size(), AsyncWrite(file.GetFd(), 0, data,
+                                    GetDefaultExecutor(),
+                                    io_service.get())->Wait());
+  std::vector<IoRange> ranges(100, IoRange{0, 10});
+  auto reads = AsyncReadRanges(file.GetFd(), ranges, GetDefaultExecutor(),
+                               io_service.get());
+  for (const auto& read : reads) {
+    ASSERT_EQ(std::string(10, 'x'), read->Wait());
+  }
+}
+
+TEST(BoundedQueue, FullAndEmpty) {
+  ASSERT_EQ(2u, BoundedQueue<int>(1).GetCapacity());
+  BoundedQueue<int> queue(3);
+  ASSERT_EQ(4u, queue.GetCapacity());
+  for (int i = 0; i < 4; i++) {
+    ASSERT_TRUE(queue.TryPush(int(i)));
+  }
+  int value = 4;
+  ASSERT_FALSE(queue.TryPush(std::move(value)));
+  for (int i = 0; i < 4; i++) {
+    ASSERT_EQ(i, queue.TryPop());
+  }
+  ASSERT_FALSE(queue.TryPop().has_value());
+}
+
+TEST(Channel, SendAndReceive) {
+  Channel<std::string> channel(4);
+  ASSERT_TRUE(channel.TrySend("a"));
+  channel.Send("b")->Wait();
+  ASSERT_EQ("a", channel.TryReceive());
+  ASSERT_EQ(std::vector<std::string>{"b"}, channel.Receive(10)->Wait());
+  ASSERT_FALSE(channel.TryReceive().has_value());
+}
+
+TEST(Channel, FullChannelParksSend) {
+  Channel<int> channel(2);
+  channel.Send(0)->Wait();
+  channel.Send(1)->Wait();
+  int value = 2;
+  ASSERT_FALSE(channel.TrySend(std::move(value)));
+
+  auto send = channel.Send(2);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  ASSERT_FALSE(send->GetFunctionExecutor()->IsReady());
+
+  // Room for the parked value is made by the receive.
+  ASSERT_EQ(std::vector<int>({0}), channel.Receive(1)->Wait());
+  send->Wait();
+  ASSERT_EQ(std::vector<int>({1, 2}), channel.Receive(10)->Wait());
+}
+
+TEST(Channel, EmptyChannelParksReceive) {
+  Channel<int> channel(2);
+  auto receive = channel.Receive(10);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  ASSERT_FALSE(receive->GetFunctionExecutor()->IsReady());
+
+  channel.Send(7)->Wait();
+  ASSERT_EQ(std::vector<int>({7}), receive->Wait());
+}
+
+TEST(Channel, Close) {
+  Channel<int> channel(2);
+  channel.Send(0)->Wait();
+  channel.Send(1)->Wait();
+  auto parked_send = channel.Send(2);
+  channel.Close();
+  ASSERT_TRUE(channel.IsClosed());
+  ASSERT_THROW(channel.Send(3)->Wait(), ChannelClosedError);
+  ASSERT_FALSE(channel.TrySend(3));
+
+  // Values, which were sent before Close, are still received.
+  ASSERT_EQ(std::vector<int>({0, 1}), channel.Receive(10)->Wait());
+  parked_send->Wait();
+  ASSERT_EQ(std::vector<int>({2}), channel.Receive(10)->Wait());
+  ASSERT_TRUE(channel.Receive(10)->Wait().empty());
+}
+
+TEST(Channel, CloseFulfillsParkedReceive) {
+  Channel<int> channel(1);
+  auto receive = channel.Receive(10);
+  channel.Close();
+  ASSERT_TRUE(receive->Wait().empty());
+}
+
+TEST(Channel, SendByThen) {
+  // Producer sends the next value from the continuation of the previous
+  // Send, so it holds no thread while the channel is full.
+  auto channel = std::make_shared<Channel<int>>(2);
+  const int kCount = 1000;
+  std::function<void(int)> send_from = [&](int value) {
+    if (value == kCount) {
+      channel->Close();
+      return;
+    }
+    auto send = channel->Send(value);
+    send->GetFunctionExecutor()->Subscribe([&, value]() {
+      send_from(value + 1);
+    });
+  };
+  send_from(0);
+
+  std::vector<int> received;
+  ForEachBatch(channel, [&](std::vector<int> values) {
+    received.insert(received.end(), values.begin(), values.end());
+  }, 16)->Wait();
+  std::vector<int> expected(kCount);
+  std::iota(expected.begin(), expected.end(), 0);
+  ASSERT_EQ(expected, received);
+}
+
+TEST(Channel, ManyProducersAndConsumers) {
+  const int kProducerCount = 4;
+  const int kConsumerCount = 4;
+  const int64_t kCount = 20000;
+  auto channel = std::make_shared<Channel<int64_t>>(64);
+
+  std::atomic<int64_t> sum(0);
+  std::atomic<int64_t> received_count(0);
+  std::vector<std::shared_ptr<Promise<void>>> consumers;
+  for (int i = 0; i < kConsumerCount; i++) {
+    consumers.push_back(ForEachBatch(channel, [&](std::vector<int64_t> values) {
+      for (int64_t value : values) {
+        sum.fetch_add(value);
+      }
+      received_count.fetch_add(values.size());
+    }, 8));
+  }
+
+  std::vector<std::thread> producers;
+  for (int i = 0; i < kProducerCount; i++) {
+    producers.emplace_back([&, i] {
+      for (int64_t value = i; value < kCount; value += kProducerCount) {
+        channel->Send(value)->Wait();
+      }
+    });
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  channel->Close();
+
+  WhenAll(consumers)->Wait();
+  ASSERT_EQ(kCount, received_count.load());
+  ASSERT_EQ(kCount * (kCount - 1) / 2, sum.load());
+}
+
+TEST(Channel, ReceiveOfNothing) {
+  auto channel = std::make_shared<Channel<int>>(4);
+  ASSERT_THROW(channel->Receive(0), std::invalid_argument);
+  ASSERT_THROW(ForEachBatch(channel, [](std::vector<int>) {}, 0),
+               std::invalid_argument);
+}
+
+TEST(Channel, ForEachBatchRunsOnExecutor) {
+  // Batches are ready right away, still they aren't consumed in the
+  // calling thread.
+  auto channel = std::make_shared<Channel<int>>(4);
+  for (int value = 0; value < 4; value++) {
+    channel->Send(value)->Wait();
+  }
+  channel->Close();
+
+  auto executor = std::make_shared<CountingExecutor>();
+  std::thread::id caller = std::this_thread::get_id();
+  std::atomic<int> caller_batch_count(0);
+  std::atomic<int> batch_count(0);
+  ForEachBatch(channel, [&](std::vector<int>) {
+    caller_batch_count.fetch_add(std::this_thread::get_id() == caller);
+    batch_count.fetch_add(1);
+  }, 1, executor)->Wait();
+  ASSERT_EQ(4, batch_count.load());
+  ASSERT_EQ(0, caller_batch_count.load());
+  // First receive, a task per batch and the last empty one.
+  ASSERT_LE(6, executor->submitted_count.load());
+}
+
+TEST(Channel, ForEachBatchRethrows) {
+  auto channel = std::make_shared<Channel<int>>(4);
+  channel->Send(1)->Wait();
+  auto consumer = ForEachBatch(channel, [](std::vector<int>) {
+    throw std::logic_error("consumer failed");
+  }, 4);
+  ASSERT_THROW(consumer->Wait(), std::logic_error);
+}
@@ -0,0 +1,283 @@
+#pragma once
+
+#include "promise.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Timings of one run of a TaskGraph.
+struct TaskGraphReport {
+  double seconds = 0;
+  std::vector<double> node_seconds;
+  // Chain of dependent nodes with the longest total time, from the first
+  // one. Run can't be faster than it, however many threads there are.
+  std::vector<size_t> critical_path;
+  double critical_path_seconds = 0;
+};
+
+// Reusable graph of tasks: each node runs once all its dependencies have
+// finished, so a stage may wait for any number of earlier ones. Graph is
+// built once and run many times: a run allocates only the counters of the
+// nodes, which start from the precomputed numbers of dependencies.
+// Nodes pass data through the state they capture, results of a run are
+// waited for through its promise, so it composes with Then and WhenAll.
+class TaskGraph {
+ public:
+  using NodeId = size_t;
+
+  // Dependencies must be added before, so ids are in topological order.
+  NodeId AddNode(std::string name, std::function<void()> function,
+                 const std::vector<NodeId>& dependencies = {});
+
+  size_t GetNodeCount() const;
+
+  // Graph mustn't be changed until the run has finished. If a node throws
+  // or executor rejects it, nodes, which depend on it, aren't called, and
+  // the promise rethrows the first exception.
+  std::shared_ptr<Promise<TaskGraphReport>> Run(
+      std::shared_ptr<Executor> executor = GetDefaultExecutor()) const;
+
+  // Times of all the nodes, the critical ones are marked with '*'.
+  void PrintReport(const TaskGraphReport& report, std::ostream* out) const;
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Node {
+    std::string name;
+    std::function<void()> function;
+    std::vector<NodeId> dependencies;
+    std::vector<NodeId> dependents;
+  };
+
+  struct Outcome {
+    std::exception_ptr exception;
+    TaskGraphReport report;
+  };
+
+  // Owned by the run itself: Run releases it and Finish deletes it.
+  struct RunState {
+    explicit RunState(size_t node_count)
+        : remaining_dependencies(node_count), starts(node_count),
+          finishes(node_count), unfinished_count(node_count) {
+    }
+
+    const TaskGraph* graph = nullptr;
+    std::shared_ptr<Executor> executor;
+    std::vector<std::atomic<size_t>> remaining_dependencies;
+    std::vector<Clock::time_point> starts;
+    std::vector<Clock::time_point> finishes;
+    Clock::time_point start;
+    std::atomic<size_t> unfinished_count;
+
+    std::atomic<bool> is_failed = false;
+    std::exception_ptr exception;
+
+    // Filled by Finish, so the function of done holds only the outcome,
+    // not the run, which owns done.
+    std::shared_ptr<Outcome> outcome = std::make_shared<Outcome>();
+    std::shared_ptr<FunctionExecutor<TaskGraphReport>> done;
+  };
+
+ private:
+  // Run is passed by a raw pointer, so the task fits into std::function
+  // without allocation.
+  static void Submit(RunState* run, NodeId id);
+  static void RunNode(RunState* run, NodeId id);
+  // Finishes the node, which executor has rejected, without calling it,
+  // and the same way its dependents, which become ready.
+  static void SkipNode(RunState* run, NodeId id);
+  // Keeps the current exception, if it is the first one of the run.
+  static void SetFailed(RunState* run);
+  static void Finish(RunState* run);
+  TaskGraphReport MakeReport(const RunState& run) const;
+
+ private:
+  std::vector<Node> nodes_;
+};
+
+inline TaskGraph::NodeId TaskGraph::AddNode(
+    std::string name, std::function<void()> function,
+    const std::vector<NodeId>& dependencies) {
+  NodeId id = nodes_.size();
+  for (NodeId dependency : dependencies) {
+    if (dependency >= id) {
+      throw std::invalid_argument("dependency of " + name + " isn't added");
+    }
+    nodes_[dependency].dependents.push_back(id);
+  }
+  nodes_.push_back({std::move(name), std::move(function), dependencies, {}});
+  return id;
+}
+
+inline size_t TaskGraph::GetNodeCount() const {
+  return nodes_.size();
+}
+
+inline std::shared_ptr<Promise<TaskGraphReport>> TaskGraph::Run(
+    std::shared_ptr<Executor> executor) const {
+  auto run = std::make_unique<RunState>(nodes_.size());
+  run->graph = this;
+  run->executor = executor;
+  for (NodeId id = 0; id < nodes_.size(); id++) {
+    run->remaining_dependencies[id].store(nodes_[id].dependencies.size());
+  }
+  run->done = MakeFunctionTask<TaskGraphReport>(
+      [outcome = run->outcome]() {
+        if (outcome->exception != nullptr) {
+          std::rethrow_exception(outcome->exception);
+        }
+        return std::move(outcome->report);
+      });
+  auto promise = std::make_shared<Promise<TaskGraphReport>>(run->done,
+                                                            executor);
+
+  run->start = Clock::now();
+  // The last node to finish deletes the run.
+  RunState* started = run.release();
+  if (nodes_.empty()) {
+    Finish(started);
+    return promise;
+  }
+  for (NodeId id = 0; id < nodes_.size(); id++) {
+    if (nodes_[id].dependencies.empty()) {
+      Submit(started, id);
+    }
+  }
+  return promise;
+}
+
+inline void TaskGraph::Submit(RunState* run, NodeId id) {
+  try {
+    run->executor->Submit([run, id]() { RunNode(run, id); });
+  } catch (...) {
+    SetFailed(run);
+    SkipNode(run, id);
+  }
+}
+
+inline void TaskGraph::RunNode(RunState* run, NodeId id) {
+  const Node& node = run->graph->nodes_[id];
+  run->starts[id] = Clock::now();
+  if (!run->is_failed.load()) {
+    try {
+      node.function();
+    } catch (...) {
+      SetFailed(run);
+    }
+  }
+  run->finishes[id] = Clock::now();
+
+  for (NodeId dependent : node.dependents) {
+    if (run->remaining_dependencies[dependent].fetch_sub(1) == 1) {
+      Submit(run, dependent);
+    }
+  }
+  if (run->unfinished_count.fetch_sub(1) == 1) {
+    Finish(run);
+  }
+}
+
+inline void TaskGraph::SkipNode(RunState* run, NodeId id) {
+  // Run has failed, so none of the nodes is called anymore, and they are
+  // finished right here instead of recursing through Submit.
+  std::vector<NodeId> skipped = {id};
+  while (!skipped.empty()) {
+    NodeId skipped_id = skipped.back();
+    skipped.pop_back();
+    run->starts[skipped_id] = run->finishes[skipped_id] = Clock::now();
+
+    for (NodeId dependent : run->graph->nodes_[skipped_id].dependents) {
+      if (run->remaining_dependencies[dependent].fetch_sub(1) == 1) {
+        skipped.push_back(dependent);
+      }
+    }
+    // Nodes in skipped are unfinished, so the run is finished only after
+    // the last of them.
+    if (run->unfinished_count.fetch_sub(1) == 1) {
+      Finish(run);
+    }
+  }
+}
+
+inline void TaskGraph::SetFailed(RunState* run) {
+  if (!run->is_failed.exchange(true)) {
+    run->exception = std::current_exception();
+  }
+}
+
+inline void TaskGraph::Finish(RunState* run) {
+  std::unique_ptr<RunState> finished(run);
+  if (run->exception != nullptr) {
+    run->outcome->exception = run->exception;
+  } else {
+    run->outcome->report = run->graph->MakeReport(*run);
+  }
+  run->done->Execute(run->executor.get());
+}
+
+inline TaskGraphReport TaskGraph::MakeReport(const RunState& run) const {
+  auto seconds = [](Clock::time_point start, Clock::time_point finish) {
+    return std::chrono::duration<double>(finish - start).count();
+  };
+
+  TaskGraphReport report;
+  report.node_seconds.resize(nodes_.size());
+  // Longest chain, which ends at the node, and the node before it.
+  std::vector<double> path_seconds(nodes_.size());
+  std::vector<NodeId> previous(nodes_.size(), nodes_.size());
+  Clock::time_point finish = run.start;
+
+  NodeId last = nodes_.size();
+  for (NodeId id = 0; id < nodes_.size(); id++) {
+    report.node_seconds[id] = seconds(run.starts[id], run.finishes[id]);
+    for (NodeId dependency : nodes_[id].dependencies) {
+      if (previous[id] == nodes_.size() ||
+          path_seconds[dependency] > path_seconds[previous[id]]) {
+        previous[id] = dependency;
+      }
+    }
+    path_seconds[id] = report.node_seconds[id];
+    if (previous[id] != nodes_.size()) {
+      path_seconds[id] += path_seconds[previous[id]];
+    }
+    if (last == nodes_.size() || path_seconds[id] > path_seconds[last]) {
+      last = id;
+    }
+    finish = std::max(finish, run.finishes[id]);
+  }
+
+  report.seconds = seconds(run.start, finish);
+  if (last != nodes_.size()) {
+    report.critical_path_seconds = path_seconds[last];
+    for (NodeId id = last; id != nodes_.size(); id = previous[id]) {
+      report.critical_path.push_back(id);
+    }
+    std::reverse(report.critical_path.begin(), report.critical_path.end());
+  }
+  return report;
+}
+
+inline void TaskGraph::PrintReport(const TaskGraphReport& report,
+                                   std::ostream* out) const {
+  std::vector<bool> is_critical(nodes_.size());
+  for (NodeId id : report.critical_path) {
+    is_critical[id] = true;
+  }
+
+  *out << std::fixed << std::setprecision(3)
+       << "critical path " << report.critical_path_seconds * 1000
+       << " ms of " << report.seconds * 1000 << " ms\n";
+  for (NodeId id = 0; id < nodes_.size(); id++) {
+    *out << (is_critical[id] ? "* " : "  ") << nodes_[id].name << " "
+         << report.node_seconds[id] * 1000 << " ms\n";
+  }
+}
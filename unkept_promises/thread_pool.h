@@ -0,0 +1,205 @@
+#pragma once
+
+#include "executor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed number of workers, each with its own queue. Tasks submitted by
+// a worker go to its queue and are taken from the back, so the newest
+// ones run first while their data is still in cache. Tasks from other
+// threads go to the shared queue. A worker without tasks takes them from
+// the shared queue, then steals the oldest ones from other workers.
+class ThreadPool : public Executor {
+ public:
+  explicit ThreadPool(size_t thread_count = GetDefaultThreadCount());
+  // Runs all submitted tasks before returning. Must not be called from
+  // the tasks of this pool.
+  ~ThreadPool() override;
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  void Submit(std::function<void()> task) override;
+
+  size_t GetThreadCount() const;
+
+  // Runs one task of the pool of the current worker, taking it the same
+  // way as the worker does, if the current thread is a worker of some
+  // pool. Blocked task calls it, so the tasks it waits for run even when
+  // all workers are blocked. Such a task must not hold locks, which the
+  // tasks run beneath it may take.
+  static bool RunPendingTask();
+
+  static bool IsWorkerThread();
+
+  static size_t GetDefaultThreadCount();
+
+ private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+ private:
+  void Run(size_t index);
+  bool PopOwnTask(size_t index, std::function<void()>* task);
+  bool PopTask(size_t index, std::function<void()>* task);
+
+ private:
+  static inline thread_local ThreadPool* current_pool_ = nullptr;
+  static inline thread_local size_t current_index_ = 0;
+
+  std::vector<Worker> workers_;
+  std::vector<std::thread> threads_;
+
+  std::mutex shared_mutex_;
+  std::deque<std::function<void()>> shared_tasks_;
+
+  // Submitted tasks, which are not taken by any worker yet.
+  std::atomic<int64_t> pending_count_{0};
+  std::atomic<int64_t> sleeping_count_{0};
+  std::mutex sleep_mutex_;
+  std::condition_variable sleep_cv_;
+  bool is_stopped_ = false;
+};
+
+inline ThreadPool::ThreadPool(size_t thread_count)
+    : workers_(std::max<size_t>(thread_count, 1)) {
+  threads_.reserve(workers_.size());
+  for (size_t index = 0; index < workers_.size(); index++) {
+    threads_.emplace_back([this, index] { Run(index); });
+  }
+}
+
+inline ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard lock_guard(sleep_mutex_);
+    is_stopped_ = true;
+  }
+  sleep_cv_.notify_all();
+
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+inline void ThreadPool::Submit(std::function<void()> task) {
+  if (current_pool_ == this) {
+    Worker& worker = workers_[current_index_];
+    std::lock_guard lock_guard(worker.mutex);
+    worker.tasks.push_back(std::move(task));
+  } else {
+    std::lock_guard lock_guard(shared_mutex_);
+    shared_tasks_.push_back(std::move(task));
+  }
+
+  // Sleeping worker increments sleeping_count_ before it checks
+  // pending_count_, so one of the sides always sees the other.
+  pending_count_.fetch_add(1);
+  if (sleeping_count_.load() > 0) {
+    std::lock_guard lock_guard(sleep_mutex_);
+    sleep_cv_.notify_one();
+  }
+}
+
+inline size_t ThreadPool::GetThreadCount() const {
+  return workers_.size();
+}
+
+inline bool ThreadPool::RunPendingTask() {
+  std::function<void()> task;
+  if (current_pool_ == nullptr ||
+      !current_pool_->PopTask(current_index_, &task)) {
+    return false;
+  }
+  task();
+  return true;
+}
+
+inline bool ThreadPool::IsWorkerThread() {
+  return current_pool_ != nullptr;
+}
+
+inline size_t ThreadPool::GetDefaultThreadCount() {
+  // Blocked workers run pending tasks themselves, but a task taking long
+  // without Wait would still hold the only worker of a single core.
+  return std::max(std::thread::hardware_concurrency(), 2u);
+}
+
+inline void ThreadPool::Run(size_t index) {
+  current_pool_ = this;
+  current_index_ = index;
+
+  std::function<void()> task;
+  while (true) {
+    if (PopTask(index, &task)) {
+      task();
+      task = nullptr;
+      continue;
+    }
+
+    std::unique_lock unique_lock(sleep_mutex_);
+    sleeping_count_.fetch_add(1);
+    sleep_cv_.wait(unique_lock, [this] {
+      return pending_count_.load() > 0 || is_stopped_;
+    });
+    sleeping_count_.fetch_sub(1);
+    if (is_stopped_ && pending_count_.load() == 0) {
+      return;
+    }
+  }
+}
+
+inline bool ThreadPool::PopOwnTask(size_t index,
+                                   std::function<void()>* task) {
+  Worker& worker = workers_[index];
+  std::lock_guard lock_guard(worker.mutex);
+  if (worker.tasks.empty()) {
+    return false;
+  }
+  *task = std::move(worker.tasks.back());
+  worker.tasks.pop_back();
+  pending_count_.fetch_sub(1);
+  return true;
+}
+
+inline bool ThreadPool::PopTask(size_t index, std::function<void()>* task) {
+  if (PopOwnTask(index, task)) {
+    return true;
+  }
+
+  {
+    std::lock_guard lock_guard(shared_mutex_);
+    if (!shared_tasks_.empty()) {
+      *task = std::move(shared_tasks_.front());
+      shared_tasks_.pop_front();
+      pending_count_.fetch_sub(1);
+      return true;
+    }
+  }
+
+  for (size_t offset = 1; offset < workers_.size(); offset++) {
+    Worker& victim = workers_[(index + offset) % workers_.size()];
+    std::lock_guard lock_guard(victim.mutex);
+    if (!victim.tasks.empty()) {
+      *task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      pending_count_.fetch_sub(1);
+      return true;
+    }
+  }
+  return false;
+}
+
+inline std::shared_ptr<Executor> GetDefaultExecutor() {
+  // Never destroyed, so promises may outlive static destructors.
+  static auto* executor =
+      new std::shared_ptr<Executor>(std::make_shared<ThreadPool>());
+  return *executor;
+}
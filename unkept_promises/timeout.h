@@ -0,0 +1,83 @@
+#pragma once
+
+#include "promise.h"
+#include "timer_wheel.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+
+// Delays and timeouts are timers of the TimerWheel, which only submit
+// the promises, so pending ones don't hold any thread.
+
+class TimeoutError : public std::runtime_error {
+ public:
+  TimeoutError() : std::runtime_error("promise has timed out") {
+  }
+};
+
+// Promise, which is fulfilled after duration.
+template<typename Rep, typename Period>
+std::shared_ptr<Promise<void>> Delay(
+    const std::chrono::duration<Rep, Period>& duration,
+    std::shared_ptr<Executor> executor = GetDefaultExecutor(),
+    TimerWheel* timer_wheel = &GetDefaultTimerWheel()) {
+  auto next = MakeFunctionTask<void>([]() {});
+  timer_wheel->Schedule(TimerWheel::Clock::now() + duration,
+                        [next, executor]() { next->Execute(executor.get()); });
+  return std::make_shared<Promise<void>>(std::move(next), std::move(executor));
+}
+
+// Promise of the same result, or of TimeoutError, if the promise isn't
+// ready after duration. The function of the promise isn't stopped by the
+// timeout, but the timer is cancelled, once the promise is ready, so
+// long timeouts of finished promises don't stay in the wheel. Result is
+// copied, as the promise may have other readers.
+template<typename ResultType, typename Rep, typename Period>
+std::shared_ptr<Promise<ResultType>> WithTimeout(
+    const std::shared_ptr<Promise<ResultType>>& promise,
+    const std::chrono::duration<Rep, Period>& duration,
+    TimerWheel* timer_wheel = &GetDefaultTimerWheel()) {
+  struct Race {
+    std::atomic<bool> is_finished = false;
+    // Written before next is submitted, so next reads it without atomics.
+    bool is_timed_out = false;
+    std::shared_ptr<FunctionExecutor<ResultType>> next;
+    std::shared_ptr<Executor> executor;
+
+    void Finish(bool timed_out) {
+      if (is_finished.exchange(true)) {
+        return;
+      }
+      is_timed_out = timed_out;
+      // Loser holds only the race, so the timer of a finished promise
+      // doesn't keep its state alive.
+      auto finished_next = std::move(next);
+      auto finished_executor = std::move(executor);
+      finished_next->Execute(finished_executor.get());
+    }
+  };
+
+  auto state = promise->GetFunctionExecutor();
+  auto race = std::make_shared<Race>();
+  race->next = MakeFunctionTask<ResultType>([race, state]() -> ResultType {
+    if (race->is_timed_out) {
+      throw TimeoutError();
+    }
+    return state->Wait();
+  });
+  race->executor = promise->GetExecutor();
+  auto result = std::make_shared<Promise<ResultType>>(
+      race->next, promise->GetExecutor(), promise->GetToken());
+
+  TimerWheel::Handle timer = timer_wheel->Schedule(
+      TimerWheel::Clock::now() + duration, [race]() { race->Finish(true); });
+  // Timer is cancelled first, so it has left the wheel, once the result
+  // is ready.
+  state->Subscribe([race, timer_wheel, timer]() {
+    timer_wheel->Cancel(timer);
+    race->Finish(false);
+  });
+  return result;
+}
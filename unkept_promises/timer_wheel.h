@@ -0,0 +1,291 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Hierarchical timer wheel, served by a single thread, so any number of
+// timers costs memory, but not threads. Time is split into ticks of a
+// millisecond. Level 0 has a slot per tick of the current 256 ticks,
+// each next level has a slot per rotation of the previous one. Timers are
+// put into the lowest level, which covers their deadline, and are moved
+// level down, when the lower level starts the rotation of their slot.
+// So adding, cancelling and firing a timer are O(1), and the thread
+// sleeps until the next nonempty slot or the next rotation.
+class TimerWheel {
+ private:
+  struct Timer;
+
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // Refers to a scheduled timer, so that its owner can cancel it. Doesn't
+  // keep the timer alive: once it fires, the handle cancels nothing.
+  class Handle {
+   public:
+    Handle() = default;
+
+   private:
+    friend class TimerWheel;
+
+    explicit Handle(std::weak_ptr<Timer> timer) : timer_(std::move(timer)) {
+    }
+
+    std::weak_ptr<Timer> timer_;
+  };
+
+  TimerWheel();
+  ~TimerWheel();
+
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+
+  // Callback is called in the thread of the wheel not earlier than
+  // deadline, rounded up to the tick, so it mustn't block or throw.
+  // Timers, which are pending on destruction, are dropped without calls.
+  Handle Schedule(Clock::time_point deadline, std::function<void()> callback);
+  // Removes the timer from the wheel, so its callback is destroyed in the
+  // calling thread instead of waiting for the deadline. Returns false, if
+  // the timer has already fired or was cancelled.
+  bool Cancel(const Handle& handle);
+
+  size_t GetPendingCount() const;
+
+ private:
+  static constexpr int kLevelCount = 4;
+  static constexpr int kSlotBits = 8;
+  static constexpr uint64_t kSlotCount = 1 << kSlotBits;
+  static constexpr uint64_t kSlotMask = kSlotCount - 1;
+  // Later deadlines wait in the last level and are moved down later.
+  static constexpr uint64_t kMaxDelay =
+      (uint64_t(1) << (kLevelCount * kSlotBits)) - 1;
+
+  using Slot = std::vector<std::shared_ptr<Timer>>;
+
+  struct Timer {
+    uint64_t deadline;
+    std::function<void()> callback;
+    // Place of the timer in the wheel, slot is nullptr once it has left.
+    Slot* slot = nullptr;
+    size_t index = 0;
+  };
+
+ private:
+  void Run();
+  uint64_t ToTick(Clock::time_point time) const;
+  // Unlike deadlines, the current time is rounded down.
+  uint64_t GetNowTick() const;
+  void Insert(std::shared_ptr<Timer> timer);
+  // Swaps the timer with the last one of its slot, so that it is O(1).
+  void Remove(Timer* timer);
+  // Moves the current slots of the upper levels down, once the lower
+  // ones start a new rotation, and takes the timers of the current tick.
+  void Advance(Slot* expired);
+  // Next tick, when something may happen.
+  uint64_t GetNextEventTick() const;
+
+ private:
+  const Clock::time_point start_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::array<std::array<Slot, kSlotCount>, kLevelCount> levels_;
+  // All timers up to this tick have fired.
+  uint64_t current_tick_ = 0;
+  size_t pending_count_ = 0;
+  bool is_stopped_ = false;
+
+  std::thread thread_;
+};
+
+inline TimerWheel::TimerWheel() : start_(Clock::now()) {
+  thread_ = std::thread([this] { Run(); });
+}
+
+inline TimerWheel::~TimerWheel() {
+  {
+    std::lock_guard lock_guard(mutex_);
+    is_stopped_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+}
+
+inline TimerWheel::Handle TimerWheel::Schedule(
+    Clock::time_point deadline, std::function<void()> callback) {
+  auto timer = std::make_shared<Timer>();
+  timer->callback = std::move(callback);
+  Handle handle(timer);
+
+  bool is_earlier;
+  {
+    std::lock_guard lock_guard(mutex_);
+    if (pending_count_ == 0) {
+      // Empty wheel skips the idle ticks at once, so the thread doesn't
+      // advance through them one by one under the lock.
+      current_tick_ = std::max(current_tick_, GetNowTick());
+    }
+    uint64_t tick = std::max(ToTick(deadline), current_tick_ + 1);
+    is_earlier = pending_count_ == 0 || tick < GetNextEventTick();
+    timer->deadline = tick;
+    Insert(std::move(timer));
+    pending_count_++;
+  }
+  // Thread sleeps until the next event, so it is woken only if the new
+  // timer comes before it.
+  if (is_earlier) {
+    cv_.notify_one();
+  }
+  return handle;
+}
+
+inline bool TimerWheel::Cancel(const Handle& handle) {
+  std::shared_ptr<Timer> timer = handle.timer_.lock();
+  if (timer == nullptr) {
+    return false;
+  }
+  {
+    std::lock_guard lock_guard(mutex_);
+    if (timer->slot == nullptr) {
+      return false;
+    }
+    Remove(timer.get());
+    pending_count_--;
+  }
+  // Callback may own anything, so it is destroyed outside of the lock.
+  // The wheel has dropped the timer, but the local pointer holds it.
+  timer->callback = nullptr;
+  return true;
+}
+
+inline size_t TimerWheel::GetPendingCount() const {
+  std::lock_guard lock_guard(mutex_);
+  return pending_count_;
+}
+
+inline uint64_t TimerWheel::ToTick(Clock::time_point time) const {
+  if (time <= start_) {
+    return 0;
+  }
+  // Rounded up, so timers never fire early.
+  auto ticks = std::chrono::ceil<std::chrono::milliseconds>(time - start_);
+  return ticks.count();
+}
+
+inline uint64_t TimerWheel::GetNowTick() const {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      Clock::now() - start_).count();
+}
+
+inline void TimerWheel::Insert(std::shared_ptr<Timer> timer) {
+  uint64_t delay = std::min(timer->deadline - current_tick_, kMaxDelay);
+  uint64_t tick = current_tick_ + delay;
+
+  // Delay is at least a rotation of the level, so the slot is moved down
+  // in the future, even if its index is the current one.
+  int level = 0;
+  while ((delay >> ((level + 1) * kSlotBits)) != 0) {
+    level++;
+  }
+  Slot& slot = levels_[level][(tick >> (level * kSlotBits)) & kSlotMask];
+  timer->slot = &slot;
+  timer->index = slot.size();
+  slot.push_back(std::move(timer));
+}
+
+inline void TimerWheel::Remove(Timer* timer) {
+  Slot& slot = *timer->slot;
+  std::swap(slot[timer->index], slot.back());
+  slot[timer->index]->index = timer->index;
+  slot.pop_back();
+  timer->slot = nullptr;
+}
+
+inline void TimerWheel::Advance(Slot* expired) {
+  current_tick_++;
+  int top_level = 0;
+  while (top_level + 1 < kLevelCount &&
+         (current_tick_ &
+          ((uint64_t(1) << ((top_level + 1) * kSlotBits)) - 1)) == 0) {
+    top_level++;
+  }
+  // Upper levels go first, so their timers reach the slots of the lower
+  // ones before those are moved down.
+  for (int level = top_level; level > 0; level--) {
+    uint64_t slot = (current_tick_ >> (level * kSlotBits)) & kSlotMask;
+    Slot timers = std::move(levels_[level][slot]);
+    levels_[level][slot].clear();
+    for (auto& timer : timers) {
+      Insert(std::move(timer));
+    }
+  }
+
+  Slot& current = levels_[0][current_tick_ & kSlotMask];
+  for (auto& timer : current) {
+    if (timer->deadline <= current_tick_) {
+      timer->slot = nullptr;
+      expired->push_back(std::move(timer));
+    } else {
+      // Deadline was later than kMaxDelay, timer goes another round.
+      Insert(std::move(timer));
+    }
+  }
+  current.clear();
+}
+
+inline uint64_t TimerWheel::GetNextEventTick() const {
+  uint64_t rotation_end = (current_tick_ | kSlotMask) + 1;
+  for (uint64_t tick = current_tick_ + 1; tick < rotation_end; tick++) {
+    if (!levels_[0][tick & kSlotMask].empty()) {
+      return tick;
+    }
+  }
+  return rotation_end;
+}
+
+inline void TimerWheel::Run() {
+  Slot expired;
+  std::unique_lock unique_lock(mutex_);
+  while (!is_stopped_) {
+    if (pending_count_ == 0) {
+      cv_.wait(unique_lock);
+      continue;
+    }
+
+    uint64_t now = GetNowTick();
+    if (now <= current_tick_) {
+      uint64_t next_event = GetNextEventTick();
+      cv_.wait_until(unique_lock,
+                     start_ + std::chrono::milliseconds(next_event));
+      continue;
+    }
+
+    // Catches up with the clock, empty ticks cost only a check.
+    while (current_tick_ < now) {
+      Advance(&expired);
+    }
+    pending_count_ -= expired.size();
+
+    unique_lock.unlock();
+    for (auto& timer : expired) {
+      timer->callback();
+    }
+    expired.clear();
+    unique_lock.lock();
+  }
+}
+
+// Shared wheel of the timeouts and delays of promises.
+inline TimerWheel& GetDefaultTimerWheel() {
+  // Never destroyed, so timers may be scheduled from static destructors.
+  static auto* timer_wheel = new TimerWheel();
+  return *timer_wheel;
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include "promise.h"
+
+#include <atomic>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Combinators don't wait for the promises in a thread: they subscribe to
+// their states, and the callback of the last (WhenAll) or the first
+// (WhenAny) finished promise submits the function, which collects the
+// results. So fan-in over any number of promises blocks no thread.
+// Results are copied from the promises, as they may have other readers.
+
+// Submits next, once all the added states are ready.
+template<typename ResultType>
+class FanIn : public std::enable_shared_from_this<FanIn<ResultType>> {
+ public:
+  FanIn(std::shared_ptr<FunctionExecutor<ResultType>> next,
+        std::shared_ptr<Executor> executor)
+      : next_(std::move(next)), executor_(std::move(executor)) {
+  }
+
+  template<typename StateType>
+  void Add(const std::shared_ptr<FunctionExecutor<StateType>>& state) {
+    remaining_.fetch_add(1);
+    state->Subscribe([fan_in = this->shared_from_this()]() {
+      fan_in->Arrive();
+    });
+  }
+
+  // Must be called after all the states are added, so next can't start
+  // before that. Starts next right away, if nothing was added.
+  std::shared_ptr<Promise<ResultType>> Start() {
+    Arrive();
+    return std::make_shared<Promise<ResultType>>(next_, executor_);
+  }
+
+ private:
+  void Arrive() {
+    if (remaining_.fetch_sub(1) == 1) {
+      next_->Execute(executor_.get());
+    }
+  }
+
+ private:
+  // One more than the number of unfinished states until Start.
+  std::atomic<size_t> remaining_ = 1;
+  std::shared_ptr<FunctionExecutor<ResultType>> next_;
+  std::shared_ptr<Executor> executor_;
+};
+
+template<typename ResultType>
+std::vector<std::shared_ptr<FunctionExecutor<ResultType>>> GetStates(
+    const std::vector<std::shared_ptr<Promise<ResultType>>>& promises) {
+  std::vector<std::shared_ptr<FunctionExecutor<ResultType>>> states;
+  states.reserve(promises.size());
+  for (const auto& promise : promises) {
+    states.push_back(promise->GetFunctionExecutor());
+  }
+  return states;
+}
+
+template<typename ResultType>
+using WhenAllResult = std::conditional_t<std::is_void_v<ResultType>, void,
+                                         std::vector<ResultType>>;
+
+// Promise of the results in the order of promises. If some of them threw,
+// the first of those exceptions in this order is rethrown.
+template<typename ResultType>
+std::shared_ptr<Promise<WhenAllResult<ResultType>>> WhenAll(
+    const std::vector<std::shared_ptr<Promise<ResultType>>>& promises,
+    std::shared_ptr<Executor> executor = GetDefaultExecutor()) {
+  auto states = GetStates(promises);
+
+  auto next = MakeFunctionTask<WhenAllResult<ResultType>>([states]() {
+    if constexpr (std::is_void_v<ResultType>) {
+      for (const auto& state : states) {
+        state->Wait();
+      }
+    } else {
+      std::vector<ResultType> results;
+      results.reserve(states.size());
+      for (const auto& state : states) {
+        results.push_back(state->Wait());
+      }
+      return results;
+    }
+  });
+
+  auto fan_in = std::make_shared<FanIn<WhenAllResult<ResultType>>>(
+      std::move(next), std::move(executor));
+  for (const auto& state : states) {
+    fan_in->Add(state);
+  }
+  return fan_in->Start();
+}
+
+// Promises may have different types, so void ones aren't supported.
+// Result is collected on the executor of the first promise.
+template<typename FirstType, typename... ResultTypes>
+std::shared_ptr<Promise<std::tuple<FirstType, ResultTypes...>>> WhenAll(
+    const std::shared_ptr<Promise<FirstType>>& first,
+    const std::shared_ptr<Promise<ResultTypes>>&... promises) {
+  static_assert(!std::is_void_v<FirstType> &&
+                    (!std::is_void_v<ResultTypes> && ...),
+                "tuple can't hold results of void promises");
+  using ResultType = std::tuple<FirstType, ResultTypes...>;
+
+  auto next = MakeFunctionTask<ResultType>(
+      [first = first->GetFunctionExecutor(),
+       states = std::make_tuple(promises->GetFunctionExecutor()...)]() {
+        return std::apply([&first](const auto&... state) {
+          return ResultType{first->Wait(), state->Wait()...};
+        }, states);
+      });
+  auto fan_in = std::make_shared<FanIn<ResultType>>(std::move(next),
+                                                   first->GetExecutor());
+  fan_in->Add(first->GetFunctionExecutor());
+  (fan_in->Add(promises->GetFunctionExecutor()), ...);
+  return fan_in->Start();
+}
+
+// Index of the promise, which finished first, and its result.
+template<typename ResultType>
+struct WhenAnyResult {
+  size_t index;
+  ResultType value;
+};
+
+template<>
+struct WhenAnyResult<void> {
+  size_t index;
+};
+
+// Promise of the first finished promise. If it threw, the exception is
+// rethrown, even if the others succeed later.
+template<typename ResultType>
+std::shared_ptr<Promise<WhenAnyResult<ResultType>>> WhenAny(
+    const std::vector<std::shared_ptr<Promise<ResultType>>>& promises,
+    std::shared_ptr<Executor> executor = GetDefaultExecutor()) {
+  if (promises.empty()) {
+    throw std::invalid_argument("WhenAny of no promises never finishes");
+  }
+
+  auto states = GetStates(promises);
+
+  struct Winner {
+    std::atomic<bool> is_found = false;
+    // Written before next is submitted, so next reads it without atomics.
+    size_t index = 0;
+    // Taken by the winner, so the losers, which may finish much later,
+    // don't keep the executor alive.
+    std::shared_ptr<Executor> executor;
+  };
+  auto winner = std::make_shared<Winner>();
+  winner->executor = executor;
+
+  auto next = MakeFunctionTask<WhenAnyResult<ResultType>>([winner, states]() {
+    const auto& state = states[winner->index];
+    if constexpr (std::is_void_v<ResultType>) {
+      state->Wait();
+      return WhenAnyResult<void>{winner->index};
+    } else {
+      return WhenAnyResult<ResultType>{winner->index, state->Wait()};
+    }
+  });
+
+  for (size_t index = 0; index < states.size(); index++) {
+    states[index]->Subscribe([winner, next, index]() {
+      if (!winner->is_found.exchange(true)) {
+        winner->index = index;
+        next->Execute(std::exchange(winner->executor, nullptr).get());
+      }
+    });
+  }
+  return std::make_shared<Promise<WhenAnyResult<ResultType>>>(
+      std::move(next), std::move(executor));
+}
@@ -1,11 +1,15 @@
 #include "utilities.h"
 
 int64_t Hash(const std::string& s, int64_t p, int64_t m) {
-  int64_t result = 0;
-  for (char ch : s) {
-    result = (__int128_t(result) * p + (ch - 'a' + 1)) % m;
-  }
-  return result;
+  return Hash<LowercaseAlphabet>(s, p, m);
+}
+
+int64_t EncodeString(const std::string& s) {
+  return EncodeString<LowercaseAlphabet>(s);
+}
+
+std::string DecodeString(int64_t code) {
+  return DecodeString<LowercaseAlphabet>(code);
 }
 
 int64_t BinaryPow(int64_t value, uint64_t power) {
@@ -20,11 +24,21 @@ int64_t BinaryPow(int64_t value, uint64_t power) {
   return result;
 }
 
-void RandomizeString(std::mt19937_64* generator, std::string* string) {
-  std::uniform_int_distribution<char> random_char('a', 'z');
-  for (char& c : *string) {
-    c = random_char(*generator);
+int64_t BinaryPow(int64_t value, uint64_t power, int64_t module) {
+  int64_t result = 1 % module;
+  value %= module;
+  while (power > 0) {
+    if (power & 1ull) {
+      result = (__int128_t(result) * value) % module;
+    }
+    value = (__int128_t(value) * value) % module;
+    power >>= 1ull;
   }
+  return result;
+}
+
+void RandomizeString(std::mt19937_64* generator, std::string* string) {
+  RandomizeString<LowercaseAlphabet>(generator, string);
 }
 
 std::vector<std::pair<int64_t, int64_t>> SplitIntoSegments(int64_t from,
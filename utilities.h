@@ -1,15 +1,106 @@
 #pragma once
 
+#include <algorithm>
 #include <random>
 #include <string>
 #include <utility>
 #include <vector>
 
-const int kAlphabetSize = 26;
+// Alphabets map characters to digits [0; kSize) and back. The character
+// with digit d adds d + 1 to the polynomial hash.
+struct LowercaseAlphabet {
+  static constexpr int kSize = 26;
+  static constexpr const char* kName = "lowercase";
+
+  static int ToDigit(char ch) { return ch - 'a'; }
+  static char ToChar(int digit) { return char('a' + digit); }
+};
+
+struct BinaryAlphabet {
+  static constexpr int kSize = 2;
+  static constexpr const char* kName = "binary";
+
+  static int ToDigit(char ch) { return ch - '0'; }
+  static char ToChar(int digit) { return char('0' + digit); }
+};
+
+struct HexAlphabet {
+  static constexpr int kSize = 16;
+  static constexpr const char* kName = "hex";
+
+  static int ToDigit(char ch) { return ch <= '9' ? ch - '0' : ch - 'a' + 10; }
+  static char ToChar(int digit) { return "0123456789abcdef"[digit]; }
+};
+
+// Printable ASCII characters from ' ' to '~'.
+struct PrintableAlphabet {
+  static constexpr int kSize = 95;
+  static constexpr const char* kName = "printable";
+
+  static int ToDigit(char ch) { return ch - ' '; }
+  static char ToChar(int digit) { return char(' ' + digit); }
+};
+
+const int kAlphabetSize = LowercaseAlphabet::kSize;
+
+template<typename Alphabet>
+int64_t Hash(const std::string& s, int64_t p, int64_t m) {
+  int64_t result = 0;
+  for (char ch : s) {
+    result = (__int128_t(result) * p + (Alphabet::ToDigit(ch) + 1)) % m;
+  }
+  return result;
+}
 
 int64_t Hash(const std::string& s, int64_t p, int64_t m);
 
+// Bijective base-Alphabet::kSize number of the string. For lowercase
+// alphabet: "" -> 0, "a" -> 1, "z" -> 26, "aa" -> 27 and so on.
+// Works while the number fits into int64_t: up to 13 lowercase characters.
+template<typename Alphabet>
+int64_t EncodeString(const std::string& s) {
+  int64_t result = 0;
+  for (char ch : s) {
+    result = result * Alphabet::kSize + (Alphabet::ToDigit(ch) + 1);
+  }
+  return result;
+}
+
+template<typename Alphabet>
+std::string DecodeString(int64_t code) {
+  std::string result;
+  while (code > 0) {
+    code--;
+    result += Alphabet::ToChar(code % Alphabet::kSize);
+    code /= Alphabet::kSize;
+  }
+  std::reverse(result.begin(), result.end());
+  return result;
+}
+
+int64_t EncodeString(const std::string& s);
+std::string DecodeString(int64_t code);
+
+// Differs for alphabets with different characters or their order.
+template<typename Alphabet>
+uint64_t GetAlphabetId() {
+  uint64_t result = 0xcbf29ce484222325ull;
+  for (int digit = 0; digit < Alphabet::kSize; digit++) {
+    result = (result ^ uint8_t(Alphabet::ToChar(digit))) * 0x100000001b3ull;
+  }
+  return result;
+}
+
 int64_t BinaryPow(int64_t value, uint64_t power);
+int64_t BinaryPow(int64_t value, uint64_t power, int64_t module);
+
+template<typename Alphabet>
+void RandomizeString(std::mt19937_64* generator, std::string* string) {
+  std::uniform_int_distribution<int> random_digit(0, Alphabet::kSize - 1);
+  for (char& c : *string) {
+    c = Alphabet::ToChar(random_digit(*generator));
+  }
+}
 
 void RandomizeString(std::mt19937_64* generator, std::string* string);
 